@@ -0,0 +1,77 @@
+#include "capture.h"
+
+#include <string.h>
+#include <errno.h>
+
+int capture_write_header(FILE *f) {
+    if (fwrite(CAPTURE_MAGIC, 1, strlen(CAPTURE_MAGIC), f) != strlen(CAPTURE_MAGIC))
+        return EIO;
+    return 0;
+}
+
+int capture_write(FILE *f, const struct event *ev, double t0) {
+    struct capture_record rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.board = ev->board;
+    rec.ch_mask = ev->ch_mask;
+    rec.seq = ev->seq;
+    rec.started = ev->started - t0;
+    rec.irq = ev->irq - t0;
+    rec.read = ev->read - t0;
+    rec.handle_time = ev->res.handle_time;
+    for (int ch = 0; ch < GROUP_MAX_CHANNELS; ch++) {
+        rec.status[ch] = ev->res.status[ch];
+        rec.integral[ch] = ev->res.integral[ch];
+        rec.samples[ch] = ev->res.samples[ch];
+        rec.nwave[ch] = ev->wave[ch] ? ev->nwave[ch] : 0;
+    }
+    rec.skew = ev->res.skew;
+    rec.ready_mask = ev->res.ready_mask;
+
+    if (fwrite(&rec, sizeof(rec), 1, f) != 1)
+        return EIO;
+    for (int ch = 0; ch < GROUP_MAX_CHANNELS; ch++)
+        if (rec.nwave[ch] && fwrite(ev->wave[ch], sizeof(float), rec.nwave[ch], f) != rec.nwave[ch])
+            return EIO;
+    return 0;
+}
+
+int capture_read_header(FILE *f) {
+    char magic[sizeof(CAPTURE_MAGIC)] = { 0 };
+    if (fread(magic, 1, strlen(CAPTURE_MAGIC), f) != strlen(CAPTURE_MAGIC))
+        return EIO;
+    if (strcmp(magic, CAPTURE_MAGIC) != 0)
+        return EIO;
+    return 0;
+}
+
+int capture_read(FILE *f, struct event *ev) {
+    struct capture_record rec;
+    size_t n = fread(&rec, 1, sizeof(rec), f);
+    if (n == 0 && feof(f))
+        return ENODATA;
+    if (n != sizeof(rec) || (rec.ch_mask >> GROUP_MAX_CHANNELS))
+        return EIO;
+
+    ev->board = rec.board;
+    ev->ch_mask = rec.ch_mask;
+    ev->seq = rec.seq;
+    ev->armed = ev->started = rec.started;
+    ev->irq = rec.irq;
+    ev->read = rec.read;
+    for (int ch = 0; ch < GROUP_MAX_CHANNELS; ch++) {
+        ev->res.status[ch] = rec.status[ch];
+        ev->res.integral[ch] = rec.integral[ch];
+        ev->res.samples[ch] = rec.samples[ch];
+        int err = event_alloc_wave(ev, ch, rec.nwave[ch]);
+        if (err)
+            return err;
+        if (rec.nwave[ch] && fread(ev->wave[ch], sizeof(float), rec.nwave[ch], f) != rec.nwave[ch])
+            return EIO;
+    }
+    ev->res.skew = rec.skew;
+    ev->res.ready_mask = rec.ready_mask;
+    ev->res.handle_time = rec.handle_time;
+    ev->measured = 1;
+    return 0;
+}
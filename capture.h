@@ -0,0 +1,46 @@
+#ifndef CAPTURE_H_INCLUDED
+#define CAPTURE_H_INCLUDED
+
+// Binary capture of pipeline events.
+//
+// File starts with CAPTURE_MAGIC followed by records in host byte order.
+// Every record is struct capture_record followed by waveforms of the channels
+// with non-zero nwave, in channel order, as float samples.
+//
+// Functions return 0 on success, a system error code (EIO if the file
+// is truncated or corrupted) or ENODATA at the end of file.
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "event.h"
+
+#define CAPTURE_MAGIC "VSDCCAP1"
+
+// All fields are naturally aligned, the layout has no padding
+struct capture_record {
+    uint32_t board;
+    uint32_t ch_mask;
+    uint64_t seq;
+    double started;    // Seconds since the start of capture
+    double irq;
+    double read;
+    double handle_time;
+    uint32_t status[GROUP_MAX_CHANNELS];
+    float integral[GROUP_MAX_CHANNELS];
+    uint32_t samples[GROUP_MAX_CHANNELS];
+    uint32_t nwave[GROUP_MAX_CHANNELS];
+    uint32_t skew;
+    uint32_t ready_mask;
+};
+
+int capture_write_header(FILE *f);
+// t0 is subtracted from event timestamps
+int capture_write(FILE *f, const struct event *ev, double t0);
+
+int capture_read_header(FILE *f);
+// Fill ev from the next record, timestamps are relative to the start of capture.
+// Waveforms are (re)allocated with event_alloc_wave.
+int capture_read(FILE *f, struct event *ev);
+
+#endif
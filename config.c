@@ -0,0 +1,565 @@
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "vsdc4.h"
+
+const char *stage_names[STAGE_COUNT] = {
+    "arm", "trigger", "dispatch", "readout", "process", "sink"
+};
+
+struct name_value {
+    const char *name;
+    uint32_t value;
+};
+
+static const struct name_value start_sources[] = {
+    { "prog", ADC_START_SRC_PROG },
+    { "a", ADC_START_SRC_A },
+    { "b", ADC_START_SRC_B },
+    { "c", ADC_START_SRC_C },
+    { "d", ADC_START_SRC_D },
+    { "bp", ADC_START_SRC_BP },
+    { NULL, 0 }
+};
+
+static const struct name_value stop_sources[] = {
+    { "timer", ADC_STOP_SRC_TIMER },
+    { "prog", ADC_STOP_SRC_PROG },
+    { "a", ADC_STOP_SRC_A },
+    { "b", ADC_STOP_SRC_B },
+    { "c", ADC_STOP_SRC_C },
+    { "d", ADC_STOP_SRC_D },
+    { "bp", ADC_STOP_SRC_BP },
+    { NULL, 0 }
+};
+
+static const struct name_value inputs[] = {
+    { "signal", ADC_INPUT_SIGNAL },
+    { "gnd", ADC_INPUT_GND },
+    { "ref_h", ADC_INPUT_REF_H },
+    { "ref_l", ADC_INPUT_REF_L },
+    { NULL, 0 }
+};
+
+static const struct name_value output_types[] = {
+    { "stdout", OUTPUT_STDOUT },
+    { "csv", OUTPUT_CSV },
+    { "capture", OUTPUT_CAPTURE },
+    { "gates", OUTPUT_GATES },
+    { NULL, 0 }
+};
+
+static const struct name_value replay_formats[] = {
+    { "capture", REPLAY_CAPTURE },
+    { "csv", REPLAY_CSV },
+    { NULL, 0 }
+};
+
+enum section {
+    SECTION_NONE,
+    SECTION_PIPELINE,
+    SECTION_BOARD,
+    SECTION_CHANNEL,
+    SECTION_STAGE,
+    SECTION_OUTPUT,
+    SECTION_REPLAY,
+    SECTION_INTEGRATOR,
+    SECTION_MONITOR
+};
+
+// State of the parser
+struct parser {
+    const char *path;
+    int line;
+    enum section section;
+    struct config *cfg;
+    struct board_config *board;
+    int ch;                    // Channel of current [channel] section
+    struct stage_config *stage;
+    struct output_config *output;
+};
+
+static void parse_error(struct parser *p, const char *msg, const char *arg) {
+    fprintf(stderr, "%s:%d: %s '%s'\n", p->path, p->line, msg, arg);
+}
+
+static char *trim(char *s) {
+    while (isspace((unsigned char)*s))
+        s++;
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1]))
+        end--;
+    *end = '\0';
+    return s;
+}
+
+static int lookup(const struct name_value *table, const char *name, uint32_t *value) {
+    for (; table->name; table++) {
+        if (strcmp(table->name, name) == 0) {
+            *value = table->value;
+            return 0;
+        }
+    }
+    return EINVAL;
+}
+
+static int parse_ulong(const char *s, unsigned long *value) {
+    char *end;
+    errno = 0;
+    *value = strtoul(s, &end, 0);
+    return (errno || *s == '\0' || *end != '\0') ? EINVAL : 0;
+}
+
+static int parse_int(const char *s, int *value) {
+    char *end;
+    errno = 0;
+    long v = strtol(s, &end, 0);
+    *value = v;
+    return (errno || *s == '\0' || *end != '\0') ? EINVAL : 0;
+}
+
+static int parse_double(const char *s, double *value) {
+    char *end;
+    errno = 0;
+    *value = strtod(s, &end);
+    return (errno || *s == '\0' || *end != '\0') ? EINVAL : 0;
+}
+
+static int begin_section(struct parser *p, char *name) {
+    struct config *cfg = p->cfg;
+    char *arg = strchr(name, ' ');
+    if (arg) {
+        *arg = '\0';
+        arg = trim(arg + 1);
+    }
+
+    if (strcmp(name, "pipeline") == 0) {
+        p->section = SECTION_PIPELINE;
+    } else if (strcmp(name, "board") == 0) {
+        if (cfg->nboards == CONFIG_MAX_BOARDS) {
+            parse_error(p, "too many boards", name);
+            return EINVAL;
+        }
+        p->board = &cfg->boards[cfg->nboards];
+        p->board->vec = cfg->nboards + 1;
+        cfg->nboards++;
+        p->section = SECTION_BOARD;
+    } else if (strcmp(name, "channel") == 0) {
+        if (p->board == NULL) {
+            parse_error(p, "channel outside of board", name);
+            return EINVAL;
+        }
+        if (arg == NULL || parse_int(arg, &p->ch) || p->ch < 0 || p->ch >= GROUP_MAX_CHANNELS) {
+            parse_error(p, "invalid channel number", arg ? arg : "");
+            return EINVAL;
+        }
+        p->board->ch_mask |= 1 << p->ch;
+        p->section = SECTION_CHANNEL;
+    } else if (strcmp(name, "stage") == 0) {
+        p->stage = NULL;
+        for (int i = 0; i < STAGE_COUNT && arg; i++)
+            if (strcmp(arg, stage_names[i]) == 0)
+                p->stage = &cfg->stages[i];
+        if (p->stage == NULL) {
+            parse_error(p, "unknown stage", arg ? arg : "");
+            return EINVAL;
+        }
+        p->section = SECTION_STAGE;
+    } else if (strcmp(name, "output") == 0) {
+        if (cfg->noutputs == CONFIG_MAX_OUTPUTS) {
+            parse_error(p, "too many outputs", name);
+            return EINVAL;
+        }
+        p->output = &cfg->outputs[cfg->noutputs++];
+        p->section = SECTION_OUTPUT;
+    } else if (strcmp(name, "replay") == 0) {
+        cfg->replay.enabled = 1;
+        p->section = SECTION_REPLAY;
+    } else if (strcmp(name, "integrator") == 0) {
+        cfg->integrate = 1;
+        p->section = SECTION_INTEGRATOR;
+    } else if (strcmp(name, "monitor") == 0) {
+        cfg->monitor = 1;
+        p->section = SECTION_MONITOR;
+    } else {
+        parse_error(p, "unknown section", name);
+        return EINVAL;
+    }
+    return 0;
+}
+
+static int set_pipeline(struct parser *p, const char *key, const char *value) {
+    struct config *cfg = p->cfg;
+    if (strcmp(key, "count") == 0)
+        return parse_ulong(value, &cfg->count);
+    if (strcmp(key, "period") == 0)
+        return parse_double(value, &cfg->period);
+    if (strcmp(key, "queue_size") == 0)
+        return parse_int(value, &cfg->queue_size);
+    if (strcmp(key, "irq_poll_us") == 0)
+        return parse_int(value, &cfg->irq_poll_us);
+    if (strcmp(key, "stats_interval") == 0)
+        return parse_double(value, &cfg->stats_interval);
+    return ENOENT;
+}
+
+static int set_board(struct parser *p, const char *key, const char *value) {
+    struct board_config *b = p->board;
+    unsigned long v;
+    if (strcmp(key, "link") == 0)
+        return parse_int(value, &b->link);
+    if (strcmp(key, "bridge") == 0)
+        return parse_int(value, &b->bridge);
+    if (strcmp(key, "start") == 0)
+        return lookup(start_sources, value, &b->start_src);
+    if (strcmp(key, "base") == 0) {
+        if (parse_ulong(value, &v))
+            return EINVAL;
+        b->base = v;
+        return 0;
+    }
+    if (strcmp(key, "sync_mux") == 0) {
+        if (parse_ulong(value, &v))
+            return EINVAL;
+        b->sync_mux = v;
+        return 0;
+    }
+    if (strcmp(key, "vec") == 0) {
+        if (parse_ulong(value, &v) || v == 0 || v > 0xFF)
+            return EINVAL;
+        b->vec = v;
+        return 0;
+    }
+    return ENOENT;
+}
+
+static int set_channel(struct parser *p, const char *key, const char *value) {
+    struct vsdc_channel_settings *s = &p->board->ch[p->ch];
+    double d;
+    unsigned long v;
+    if (strcmp(key, "stop") == 0)
+        return lookup(stop_sources, value, &s->stop_src);
+    if (strcmp(key, "input") == 0)
+        return lookup(inputs, value, &s->input);
+    if (strcmp(key, "time") == 0) {
+        if (parse_double(value, &d) || d <= 0)
+            return EINVAL;
+        s->time = d;
+        return 0;
+    }
+    if (strcmp(key, "avgn") == 0) {
+        if (parse_ulong(value, &v))
+            return EINVAL;
+        s->avgn = v;
+        return 0;
+    }
+    if (strcmp(key, "waveform") == 0) {
+        if (parse_ulong(value, &v) || v > 1)
+            return EINVAL;
+        if (v)
+            p->board->wave_mask |= 1 << p->ch;
+        else
+            p->board->wave_mask &= ~(1 << p->ch);
+        return 0;
+    }
+    return ENOENT;
+}
+
+static int set_stage(struct parser *p, const char *key, const char *value) {
+    if (strcmp(key, "threads") == 0)
+        return parse_int(value, &p->stage->threads);
+    if (strcmp(key, "cpu") == 0)
+        return parse_int(value, &p->stage->cpu);
+    return ENOENT;
+}
+
+static int set_output(struct parser *p, const char *key, const char *value) {
+    if (strcmp(key, "type") == 0) {
+        uint32_t type;
+        if (lookup(output_types, value, &type))
+            return EINVAL;
+        p->output->type = (enum output_type)type;
+        return 0;
+    }
+    if (strcmp(key, "path") == 0) {
+        if (strlen(value) >= CONFIG_PATH_MAX)
+            return EINVAL;
+        strcpy(p->output->path, value);
+        return 0;
+    }
+    return ENOENT;
+}
+
+static int set_replay(struct parser *p, const char *key, const char *value) {
+    struct replay_config *r = &p->cfg->replay;
+    if (strcmp(key, "format") == 0) {
+        uint32_t format;
+        if (lookup(replay_formats, value, &format))
+            return EINVAL;
+        r->format = (enum replay_format)format;
+        return 0;
+    }
+    if (strcmp(key, "path") == 0) {
+        if (strlen(value) >= CONFIG_PATH_MAX)
+            return EINVAL;
+        strcpy(r->path, value);
+        return 0;
+    }
+    if (strcmp(key, "speed") == 0) {
+        if (parse_double(value, &r->speed) || r->speed < 0)
+            return EINVAL;
+        return 0;
+    }
+    if (strcmp(key, "repeat") == 0)
+        return parse_ulong(value, &r->repeat);
+    if (strcmp(key, "board") == 0) {
+        if (parse_int(value, &r->board) || r->board < 0 || r->board >= CONFIG_MAX_BOARDS)
+            return EINVAL;
+        return 0;
+    }
+    if (strcmp(key, "ch") == 0) {
+        if (parse_int(value, &r->ch) || r->ch < 0 || r->ch >= GROUP_MAX_CHANNELS)
+            return EINVAL;
+        return 0;
+    }
+    if (strcmp(key, "sample_period") == 0) {
+        if (parse_double(value, &r->sample_period) || r->sample_period <= 0)
+            return EINVAL;
+        return 0;
+    }
+    return ENOENT;
+}
+
+// Window is given as "start length" in samples
+static int parse_window(const char *s, struct window *w) {
+    unsigned long start, length;
+    char end;
+    if (sscanf(s, "%lu %lu %c", &start, &length, &end) != 2 || start > UINT32_MAX || length > UINT32_MAX)
+        return EINVAL;
+    w->start = start;
+    w->length = length;
+    return 0;
+}
+
+static int set_integrator(struct parser *p, const char *key, const char *value) {
+    struct integrator_config *in = &p->cfg->integrator;
+    double d;
+    if (strcmp(key, "gate") == 0) {
+        if (in->ngates == INTEGRATOR_MAX_GATES) {
+            parse_error(p, "too many gates", value);
+            return EINVAL;
+        }
+        return parse_window(value, &in->gates[in->ngates++]);
+    }
+    if (strcmp(key, "baseline") == 0)
+        return parse_window(value, &in->baseline);
+    if (strcmp(key, "pileup_threshold") == 0) {
+        if (parse_double(value, &d) || d < 0)
+            return EINVAL;
+        in->pileup_threshold = d;
+        return 0;
+    }
+    if (strcmp(key, "sample_period") == 0) {
+        if (parse_double(value, &in->sample_period) || in->sample_period <= 0)
+            return EINVAL;
+        return 0;
+    }
+    return ENOENT;
+}
+
+static int set_monitor(struct parser *p, const char *key, const char *value) {
+    struct monitor_config *m = &p->cfg->monitor_cfg;
+    if (strcmp(key, "interval") == 0) {
+        if (parse_double(value, &m->interval) || m->interval <= 0)
+            return EINVAL;
+        return 0;
+    }
+    if (strcmp(key, "max_bus_share") == 0) {
+        if (parse_double(value, &m->max_bus_share) || m->max_bus_share < 0 || m->max_bus_share > 1)
+            return EINVAL;
+        return 0;
+    }
+    return ENOENT;
+}
+
+static int set_value(struct parser *p, const char *key, const char *value) {
+    switch (p->section) {
+    case SECTION_PIPELINE: return set_pipeline(p, key, value);
+    case SECTION_BOARD: return set_board(p, key, value);
+    case SECTION_CHANNEL: return set_channel(p, key, value);
+    case SECTION_STAGE: return set_stage(p, key, value);
+    case SECTION_OUTPUT: return set_output(p, key, value);
+    case SECTION_REPLAY: return set_replay(p, key, value);
+    case SECTION_INTEGRATOR: return set_integrator(p, key, value);
+    case SECTION_MONITOR: return set_monitor(p, key, value);
+    default: return ENOENT;
+    }
+}
+
+static void set_defaults(struct config *cfg) {
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->count = 1;
+    cfg->queue_size = 16;
+    cfg->irq_poll_us = 100;
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        cfg->stages[i].threads = 1;
+        cfg->stages[i].cpu = -1;
+    }
+    cfg->replay.speed = 1;
+    cfg->replay.repeat = 1;
+    cfg->replay.sample_period = 1e-6;
+    cfg->integrator.sample_period = 1e-6;
+    cfg->monitor_cfg.interval = 1;
+    cfg->monitor_cfg.max_bus_share = 0.01;
+    for (int i = 0; i < CONFIG_MAX_BOARDS; i++) {
+        for (int ch = 0; ch < GROUP_MAX_CHANNELS; ch++) {
+            cfg->boards[i].ch[ch].stop_src = ADC_STOP_SRC_TIMER;
+            cfg->boards[i].ch[ch].input = ADC_INPUT_SIGNAL;
+            cfg->boards[i].ch[ch].time = 0.001;
+        }
+    }
+}
+
+// Check values which cannot be checked while parsing
+static int validate(const char *path, struct config *cfg) {
+    if (cfg->replay.enabled) {
+        if (cfg->replay.path[0] == '\0') {
+            fprintf(stderr, "%s: replay has no path\n", path);
+            return EINVAL;
+        }
+        if (cfg->stages[STAGE_READOUT].threads != 1) {
+            fprintf(stderr, "%s: replay requires a single readout thread\n", path);
+            return EINVAL;
+        }
+    } else if (cfg->nboards == 0) {
+        fprintf(stderr, "%s: no boards\n", path);
+        return EINVAL;
+    }
+    for (int i = 0; i < cfg->nboards; i++) {
+        const struct board_config *b = &cfg->boards[i];
+        if (b->ch_mask == 0) {
+            fprintf(stderr, "%s: board %d has no channels\n", path, i);
+            return EINVAL;
+        }
+        // IRQs are routed to boards by bridge and vector
+        for (int j = 0; j < i; j++) {
+            const struct board_config *other = &cfg->boards[j];
+            if (other->link == b->link && other->bridge == b->bridge && other->vec == b->vec) {
+                fprintf(stderr, "%s: boards %d and %d share vector %d on the same bridge\n",
+                        path, j, i, b->vec);
+                return EINVAL;
+            }
+        }
+        // Only the highest channel raises IRQ, so every channel must stop
+        // no later than it. The pipeline never issues a program stop.
+        const struct vsdc_channel_settings *first = NULL;
+        for (int ch = 0; ch < GROUP_MAX_CHANNELS; ch++) {
+            if (!(b->ch_mask & (1 << ch)))
+                continue;
+            const struct vsdc_channel_settings *s = &b->ch[ch];
+            if (s->stop_src == ADC_STOP_SRC_PROG) {
+                fprintf(stderr, "%s: board %d channel %d: program stop is not supported\n",
+                        path, i, ch);
+                return EINVAL;
+            }
+            if (first == NULL)
+                first = s;
+            else if (s->stop_src != first->stop_src ||
+                     (s->stop_src == ADC_STOP_SRC_TIMER && s->time != first->time)) {
+                fprintf(stderr, "%s: board %d channel %d: stop and time must be the same "
+                                "for all channels of a board\n", path, i, ch);
+                return EINVAL;
+            }
+        }
+    }
+    if (cfg->queue_size <= 0 || cfg->irq_poll_us < 0) {
+        fprintf(stderr, "%s: invalid pipeline settings\n", path);
+        return EINVAL;
+    }
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        int threads = cfg->stages[i].threads;
+        // Only stateless stages may run on several threads
+        int parallel = i == STAGE_READOUT || i == STAGE_PROCESS;
+        if (threads < 1 || (threads > 1 && !parallel)) {
+            fprintf(stderr, "%s: invalid number of threads for stage %s\n", path, stage_names[i]);
+            return EINVAL;
+        }
+        int cpu = cfg->stages[i].cpu;
+        if (cpu < -1 || (cpu >= 0 && ncpus > 0 && cpu >= ncpus)) {
+            fprintf(stderr, "%s: stage %s: CPU %d is not available, %ld online\n",
+                    path, stage_names[i], cpu, ncpus);
+            return EINVAL;
+        }
+    }
+    for (int i = 0; i < cfg->noutputs; i++) {
+        if (cfg->outputs[i].type != OUTPUT_STDOUT && cfg->outputs[i].path[0] == '\0') {
+            fprintf(stderr, "%s: output %d has no path\n", path, i);
+            return EINVAL;
+        }
+    }
+    return 0;
+}
+
+int config_load(const char *path, struct config *cfg) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return errno;
+
+    set_defaults(cfg);
+    struct parser p;
+    memset(&p, 0, sizeof(p));
+    p.path = path;
+    p.cfg = cfg;
+
+    char buf[512];
+    int err = 0;
+    while (!err && fgets(buf, sizeof(buf), f)) {
+        p.line++;
+        char *comment = strchr(buf, '#');
+        if (comment)
+            *comment = '\0';
+        char *line = trim(buf);
+        if (*line == '\0')
+            continue;
+
+        if (*line == '[') {
+            char *end = strchr(line, ']');
+            if (end == NULL || end[1] != '\0') {
+                parse_error(&p, "invalid section header", line);
+                err = EINVAL;
+                break;
+            }
+            *end = '\0';
+            err = begin_section(&p, trim(line + 1));
+            continue;
+        }
+
+        char *eq = strchr(line, '=');
+        if (eq == NULL) {
+            parse_error(&p, "expected key = value", line);
+            err = EINVAL;
+            break;
+        }
+        *eq = '\0';
+        char *key = trim(line);
+        char *value = trim(eq + 1);
+        err = set_value(&p, key, value);
+        if (err == ENOENT)
+            parse_error(&p, "unknown key", key);
+        else if (err)
+            parse_error(&p, "invalid value", value);
+        if (err)
+            err = EINVAL;
+    }
+    fclose(f);
+    if (err)
+        return err;
+    return validate(path, cfg);
+}
@@ -0,0 +1,121 @@
+#ifndef CONFIG_H_INCLUDED
+#define CONFIG_H_INCLUDED
+
+// Declarative description of the acquisition pipeline.
+//
+// The config file consists of sections with "key = value" lines,
+// "#" starts a comment. See pipeline.conf for an example.
+//
+//   [pipeline]    count, period, queue_size, irq_poll_us, stats_interval
+//   [board]       link, bridge, base, start, sync_mux, vec
+//   [channel N]   stop, input, time, avgn, waveform (belongs to the last [board])
+//   [stage NAME]  threads, cpu
+//   [output]      type (stdout, csv, capture or gates), path
+//   [integrator]  gate (may be repeated), baseline, pileup_threshold, sample_period
+//   [monitor]     interval, max_bus_share
+//   [replay]      format (capture or csv), path, speed, repeat,
+//                 board, ch, sample_period
+//
+// All channels of a board must have the same stop and time, since the board
+// is read out on the IRQ of its highest channel. Program stop is not supported.
+//
+// If [replay] is present, boards are not accessed: recorded events are pushed
+// directly into the process stage instead of arm, trigger, dispatch and readout.
+
+#include <stdint.h>
+
+#include "vsdc_group.h"
+#include "integrator.h"
+#include "monitor.h"
+
+#define CONFIG_MAX_BOARDS 8
+#define CONFIG_MAX_OUTPUTS 4
+#define CONFIG_PATH_MAX 256
+
+enum stage {
+    STAGE_ARM,
+    STAGE_TRIGGER,
+    STAGE_DISPATCH,
+    STAGE_READOUT,
+    STAGE_PROCESS,
+    STAGE_SINK,
+    STAGE_COUNT
+};
+
+extern const char *stage_names[STAGE_COUNT];
+
+struct board_config {
+    int link;
+    int bridge;           // Board number of the CAEN bridge on the link
+    uint32_t base;
+    uint32_t start_src;   // Shared by all channels of the board
+    uint32_t sync_mux;
+    uint8_t vec;
+    uint8_t ch_mask;
+    uint8_t wave_mask;    // Channels with waveform readout
+    struct vsdc_channel_settings ch[GROUP_MAX_CHANNELS];
+};
+
+struct stage_config {
+    int threads;
+    int cpu;              // CPU to pin workers to, -1 if not pinned
+};
+
+enum output_type {
+    OUTPUT_STDOUT,
+    OUTPUT_CSV,
+    OUTPUT_CAPTURE,    // Binary format, see capture.h
+    OUTPUT_GATES       // Host-side integrals as csv
+};
+
+struct output_config {
+    enum output_type type;
+    char path[CONFIG_PATH_MAX];
+};
+
+enum replay_format {
+    REPLAY_CAPTURE,    // Output of OUTPUT_CAPTURE
+    REPLAY_CSV         // Single waveform, one sample per line like wave.csv
+};
+
+struct replay_config {
+    int enabled;
+    enum replay_format format;
+    char path[CONFIG_PATH_MAX];
+    double speed;         // Multiple of the original rate, 0 - as fast as possible
+    unsigned long repeat; // Times to replay the file
+    // Only for csv: where the waveform came from and its sampling period
+    int board;
+    int ch;
+    double sample_period;
+};
+
+struct config {
+    unsigned long count;  // Measurements per board, 0 - until stopped
+    double period;        // Min seconds between program starts
+    int queue_size;
+    int irq_poll_us;
+    double stats_interval; // Seconds between stats reports, 0 - only at exit
+
+    int nboards;
+    struct board_config boards[CONFIG_MAX_BOARDS];
+
+    struct stage_config stages[STAGE_COUNT];
+
+    int noutputs;
+    struct output_config outputs[CONFIG_MAX_OUTPUTS];
+
+    struct replay_config replay;
+
+    int integrate;        // Non-zero if [integrator] is present
+    struct integrator_config integrator;
+
+    int monitor;          // Non-zero if [monitor] is present
+    struct monitor_config monitor_cfg;
+};
+
+// Load config from file.
+// Returns 0 on success, parse errors are printed to stderr and reported as EINVAL.
+int config_load(const char *path, struct config *cfg);
+
+#endif
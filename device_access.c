@@ -1,12 +1,15 @@
 #include "device_access.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <string.h>
 #include <pthread.h>
 
 #include <CAENVMElib.h>
 
+#include "timing.h"
+
 const CVAddressModifier addr_mod = cvA32_U_DATA; // A32 non-privileged data access
 const CVDataWidth data_width = cvD32;
 
@@ -87,6 +90,96 @@ int cv_write(device *dev, uint32_t address, uint32_t data) {
     return cverr;
 }
 
+// Max number of bytes passed to CAENVME_BLTReadCycle at once
+#define BLT_CHUNK 4096
+
+int cv_read_block(device *dev, uint32_t address, void *buf, int size) {
+    int32_t handle;
+    cv_lock(dev, &handle);
+    for (int done = 0; done < size;) {
+        int n = size - done < BLT_CHUNK ? size - done : BLT_CHUNK;
+        int count;
+        CVErrorCodes cverr = CAENVME_BLTReadCycle(handle, address + done, (char *)buf + done, n,
+                                                  cvA32_U_BLT, data_width, &count);
+        if (cverr == cvSuccess && count <= 0)
+            cverr = cvBusError;
+        if (cverr) {
+            cv_unlock(dev);
+            return cverr;
+        }
+        done += count;
+    }
+    cv_unlock(dev);
+    return 0;
+}
+
+// Max number of cycles passed to CAENVME_MultiRead at once
+#define MULTI_CYCLES 64
+
+int cv_read_multi(device *dev, const uint32_t *addresses, uint32_t *data, int count) {
+    return cv_read_multi_timed(dev, addresses, data, count, NULL);
+}
+
+int cv_read_multi_timed(device *dev, const uint32_t *addresses, uint32_t *data, int count,
+                        double *hold) {
+    CVAddressModifier ams[MULTI_CYCLES];
+    CVDataWidth dws[MULTI_CYCLES];
+    CVErrorCodes ecs[MULTI_CYCLES];
+    uint32_t addrs[MULTI_CYCLES];
+    for (int i = 0; i < MULTI_CYCLES; i++) {
+        ams[i] = addr_mod;
+        dws[i] = data_width;
+    }
+
+    int32_t handle;
+    cv_lock(dev, &handle);
+    double locked = now();
+    CVErrorCodes cverr = cvSuccess;
+    for (int done = 0; done < count && !cverr; done += MULTI_CYCLES) {
+        int n = count - done < MULTI_CYCLES ? count - done : MULTI_CYCLES;
+        for (int i = 0; i < n; i++)
+            addrs[i] = addresses[done + i];
+        cverr = CAENVME_MultiRead(handle, addrs, data + done, n, ams, dws, ecs);
+        for (int i = 0; i < n && !cverr; i++)
+            cverr = ecs[i];
+    }
+    if (hold)
+        *hold = now() - locked;
+    cv_unlock(dev);
+    return cverr;
+}
+
+int cv_write_multi(device *dev, const uint32_t *addresses, const uint32_t *data, int count) {
+    CVAddressModifier ams[MULTI_CYCLES];
+    CVDataWidth dws[MULTI_CYCLES];
+    CVErrorCodes ecs[MULTI_CYCLES];
+    uint32_t addrs[MULTI_CYCLES];
+    uint32_t buf[MULTI_CYCLES];
+    for (int i = 0; i < MULTI_CYCLES; i++) {
+        ams[i] = addr_mod;
+        dws[i] = data_width;
+    }
+
+    int32_t handle;
+    cv_lock(dev, &handle);
+    for (int done = 0; done < count; done += MULTI_CYCLES) {
+        int n = count - done < MULTI_CYCLES ? count - done : MULTI_CYCLES;
+        for (int i = 0; i < n; i++) {
+            addrs[i] = addresses[done + i];
+            buf[i] = data[done + i];
+        }
+        CVErrorCodes cverr = CAENVME_MultiWrite(handle, addrs, buf, n, ams, dws, ecs);
+        for (int i = 0; i < n && !cverr; i++)
+            cverr = ecs[i];
+        if (cverr) {
+            cv_unlock(dev);
+            return cverr;
+        }
+    }
+    cv_unlock(dev);
+    return 0;
+}
+
 int cv_get_irq_vector(device *dev, uint8_t *vec) {
     int32_t handle;
     cv_lock(dev, &handle);
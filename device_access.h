@@ -34,6 +34,23 @@ int cv_unlock(device *dev);
 int cv_read(device *dev, uint32_t address, uint32_t *data);
 int cv_write(device *dev, uint32_t address, uint32_t data);
 
+// Read count registers with a single CAENVME_MultiRead transaction.
+// The device is locked once for the whole batch, so the values are
+// consistent with each other and other threads cannot interleave.
+// data[i] receives the value of addresses[i].
+int cv_read_multi(device *dev, const uint32_t *addresses, uint32_t *data, int count);
+// Same as cv_read_multi, hold receives seconds the device was locked,
+// not counting the wait for the lock.
+int cv_read_multi_timed(device *dev, const uint32_t *addresses, uint32_t *data, int count,
+                        double *hold);
+
+// Write count registers with a single CAENVME_MultiWrite transaction.
+int cv_write_multi(device *dev, const uint32_t *addresses, const uint32_t *data, int count);
+
+// Read size bytes starting from address using block transfer cycles.
+// The device stays locked until the whole buffer is read.
+int cv_read_block(device *dev, uint32_t address, void *buf, int size);
+
 // Get current interrupt vector.
 // Interrupt vector returned via vec argument.
 // If there is no active IRQ then interrupt vector is set to 0.
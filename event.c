@@ -0,0 +1,37 @@
+#include "event.h"
+
+#include <stdlib.h>
+#include <errno.h>
+
+struct event *event_new(int board, uint8_t ch_mask, unsigned long seq) {
+    struct event *ev = (struct event *) calloc(1, sizeof(struct event));
+    if (ev) {
+        ev->board = board;
+        ev->ch_mask = ch_mask;
+        ev->seq = seq;
+    }
+    return ev;
+}
+
+int event_alloc_wave(struct event *ev, int ch, uint32_t samples) {
+    if (samples == 0) {
+        free(ev->wave[ch]);
+        ev->wave[ch] = NULL;
+        ev->nwave[ch] = 0;
+        return 0;
+    }
+    float *wave = (float *) realloc(ev->wave[ch], samples * sizeof(float));
+    if (wave == NULL)
+        return ENOMEM;
+    ev->wave[ch] = wave;
+    ev->nwave[ch] = samples;
+    return 0;
+}
+
+void event_free(struct event *ev) {
+    if (ev == NULL)
+        return;
+    for (int ch = 0; ch < GROUP_MAX_CHANNELS; ch++)
+        free(ev->wave[ch]);
+    free(ev);
+}
@@ -0,0 +1,38 @@
+#ifndef EVENT_H_INCLUDED
+#define EVENT_H_INCLUDED
+
+// A single measurement of a channel group as it travels through the pipeline.
+
+#include <stdint.h>
+
+#include "vsdc_group.h"
+#include "integrator.h"
+
+struct event {
+    int board;
+    uint8_t ch_mask;
+    unsigned long seq;
+    // Timestamps in seconds, CLOCK_MONOTONIC
+    double armed;
+    double started;
+    double irq;
+    double read;
+    int measured;          // Non-zero if res was read from a board
+    struct vsdc_group_result res;
+    // Optional waveforms, NULL if not recorded
+    float *wave[GROUP_MAX_CHANNELS];
+    uint32_t nwave[GROUP_MAX_CHANNELS];
+    // Host-side integrals of the waveforms
+    uint8_t host_mask;
+    struct integrator_result host[GROUP_MAX_CHANNELS];
+};
+
+// Allocate zero-filled event, returns NULL if out of memory
+struct event *event_new(int board, uint8_t ch_mask, unsigned long seq);
+// Allocate waveform buffer of the channel, returns 0 or ENOMEM.
+// Zero samples leave the channel without a waveform (NULL).
+int event_alloc_wave(struct event *ev, int ch, uint32_t samples);
+// Free event with its waveforms
+void event_free(struct event *ev);
+
+#endif
@@ -0,0 +1,228 @@
+#include "integrator.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <errno.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+void integrator_init(struct integrator *in, const struct integrator_config *cfg) {
+    in->cfg = cfg;
+    in->prefix = NULL;
+    in->capacity = 0;
+}
+
+void integrator_destroy(struct integrator *in) {
+    free(in->prefix);
+    in->prefix = NULL;
+    in->capacity = 0;
+}
+
+#ifdef __SSE2__
+
+// Four samples per iteration: every pair is summed in register,
+// then the running total of the previous samples is added
+void prefix_sum(const float *x, uint32_t n, double *p) {
+    p[0] = 0;
+    __m128d zero = _mm_setzero_pd();
+    __m128d carry = zero;
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_loadu_ps(x + i);
+        __m128d lo = _mm_cvtps_pd(v);                   // x0, x1
+        __m128d hi = _mm_cvtps_pd(_mm_movehl_ps(v, v)); // x2, x3
+        lo = _mm_add_pd(lo, _mm_unpacklo_pd(zero, lo)); // x0, x0 + x1
+        hi = _mm_add_pd(hi, _mm_unpacklo_pd(zero, hi)); // x2, x2 + x3
+        lo = _mm_add_pd(lo, carry);
+        hi = _mm_add_pd(hi, _mm_unpackhi_pd(lo, lo));
+        _mm_storeu_pd(p + i + 1, lo);
+        _mm_storeu_pd(p + i + 3, hi);
+        carry = _mm_unpackhi_pd(hi, hi);
+    }
+    double sum = p[i];
+    for (; i < n; i++) {
+        sum += x[i];
+        p[i + 1] = sum;
+    }
+}
+
+#else
+
+void prefix_sum(const float *x, uint32_t n, double *p) {
+    double sum = 0;
+    p[0] = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        sum += x[i];
+        p[i + 1] = sum;
+    }
+}
+
+#endif
+
+// Clip window to n samples, returns the end of the window
+static uint32_t clip(const struct window *w, uint32_t n, uint32_t *start) {
+    *start = w->start < n ? w->start : n;
+    uint32_t len = w->length < n - *start ? w->length : n - *start;
+    return *start + len;
+}
+
+// Count pulses crossing threshold above baseline,
+// a pulse ends when the signal falls below half of the threshold
+static int count_pulses(const float *x, uint32_t start, uint32_t end, float baseline, float threshold) {
+    int pulses = 0;
+    int high = 0;
+    for (uint32_t i = start; i < end; i++) {
+        float v = x[i] - baseline;
+        if (!high && v > threshold) {
+            high = 1;
+            pulses++;
+        } else if (high && v < threshold / 2) {
+            high = 0;
+        }
+    }
+    return pulses;
+}
+
+int integrator_run(struct integrator *in, const float *wave, uint32_t n,
+                   struct integrator_result *res) {
+    const struct integrator_config *cfg = in->cfg;
+
+    if (in->capacity < n + 1) {
+        double *prefix = (double *) realloc(in->prefix, (n + 1) * sizeof(double));
+        if (prefix == NULL)
+            return ENOMEM;
+        in->prefix = prefix;
+        in->capacity = n + 1;
+    }
+    double *p = in->prefix;
+    prefix_sum(wave, n, p);
+
+    uint32_t start, end;
+    double baseline = 0;
+    end = clip(&cfg->baseline, n, &start);
+    if (end > start)
+        baseline = (p[end] - p[start]) / (end - start);
+    res->baseline = baseline;
+
+    uint32_t measured = n > INTEGRATOR_TAIL_SAMPLES ? n - INTEGRATOR_TAIL_SAMPLES : n;
+    // Like ADC_INT, the total has no baseline subtracted
+    res->total = p[measured] * cfg->sample_period;
+
+    res->pileup_mask = 0;
+    for (int g = 0; g < cfg->ngates; g++) {
+        end = clip(&cfg->gates[g], n, &start);
+        res->gate[g] = (p[end] - p[start] - baseline * (end - start)) * cfg->sample_period;
+        if (cfg->pileup_threshold > 0 &&
+            count_pulses(wave, start, end, baseline, cfg->pileup_threshold) > 1)
+            res->pileup_mask |= 1 << g;
+    }
+    return 0;
+}
+
+// Simulated waveform for integrator_check: n is not a multiple of 4,
+// so both the vector and the scalar part of prefix_sum are used
+#define CHECK_SAMPLES (4096 + INTEGRATOR_TAIL_SAMPLES + 3)
+#define CHECK_BASELINE 0.25
+#define CHECK_TAU 40.0
+#define CHECK_PERIOD 1e-6
+
+struct pulse {
+    uint32_t start;
+    double amplitude;
+};
+
+// The last pulse arrives after the stop and must not be in the total
+static const struct pulse check_pulses[] = {
+    { 1000, 1.0 }, { 2000, 0.5 }, { CHECK_SAMPLES - 100, 1.0 }
+};
+#define CHECK_PULSES (int)(sizeof(check_pulses) / sizeof(check_pulses[0]))
+
+// Signal of the board input at sample i
+static double signal(uint32_t i) {
+    double v = CHECK_BASELINE;
+    for (int k = 0; k < CHECK_PULSES; k++)
+        if (i >= check_pulses[k].start)
+            v += check_pulses[k].amplitude * exp(-(double)(i - check_pulses[k].start) / CHECK_TAU);
+    return v;
+}
+
+// What the board puts into ADC_INT: the raw integral of the samples
+// recorded before the stop, nothing subtracted
+static double model_adc_int(uint32_t measured) {
+    double sum = 0;
+    for (uint32_t i = 0; i < measured; i++)
+        sum += signal(i);
+    return sum * CHECK_PERIOD;
+}
+
+// Integral of samples [start, end) above the baseline
+static double model_gate(uint32_t start, uint32_t end) {
+    double sum = 0;
+    for (uint32_t i = start; i < end; i++)
+        sum += signal(i) - CHECK_BASELINE;
+    return sum * CHECK_PERIOD;
+}
+
+// Same deviation as the sink reports for host integral vs ADC_INT
+static int check_value(const char *name, double value, double expected, double scale) {
+    double dev = fabs(value - expected) / scale;
+    if (dev <= INTEGRATOR_CHECK_TOLERANCE)
+        return 0;
+    fprintf(stderr, "integrator check: %s is %e, expected %e, deviation %.3g%%\n",
+            name, value, expected, dev * 100);
+    return ERANGE;
+}
+
+int integrator_check(void) {
+    const uint32_t n = CHECK_SAMPLES;
+    const uint32_t measured = n - INTEGRATOR_TAIL_SAMPLES;
+
+    struct integrator_config cfg;
+    cfg.baseline.start = 0;
+    cfg.baseline.length = 500;
+    cfg.ngates = 3;
+    cfg.gates[0].start = 1000;  // First pulse only
+    cfg.gates[0].length = 500;
+    cfg.gates[1].start = 500;   // First and second pulses
+    cfg.gates[1].length = 2000;
+    cfg.gates[2].start = 4000;  // Clipped to the end of the waveform, the tail pulse
+    cfg.gates[2].length = 1000;
+    cfg.pileup_threshold = 0.1;
+    cfg.sample_period = CHECK_PERIOD;
+
+    float *wave = (float *) malloc(n * sizeof(float));
+    if (wave == NULL)
+        return ENOMEM;
+    for (uint32_t i = 0; i < n; i++)
+        wave[i] = signal(i);
+
+    struct integrator in;
+    struct integrator_result res;
+    integrator_init(&in, &cfg);
+    int err = integrator_run(&in, wave, n, &res);
+    integrator_destroy(&in);
+    free(wave);
+    if (err)
+        return err;
+
+    double adc_int = model_adc_int(measured);
+    err |= check_value("baseline", res.baseline, CHECK_BASELINE, CHECK_BASELINE);
+    err |= check_value("total vs ADC_INT", res.total, adc_int, fabs(adc_int));
+    // Gates are compared with the integral of the first pulse, some are close to 0
+    double scale = model_gate(1000, 1500);
+    for (int g = 0; g < cfg.ngates; g++) {
+        uint32_t start = cfg.gates[g].start;
+        uint32_t end = start + cfg.gates[g].length < n ? start + cfg.gates[g].length : n;
+        char name[16];
+        snprintf(name, sizeof(name), "gate %d", g);
+        err |= check_value(name, res.gate[g], model_gate(start, end), scale);
+    }
+    if (res.pileup_mask != (1 << 1)) {
+        fprintf(stderr, "integrator check: pile-up mask is 0x%X, expected 0x2\n", res.pileup_mask);
+        err = ERANGE;
+    }
+    return err ? ERANGE : 0;
+}
@@ -0,0 +1,71 @@
+#ifndef INTEGRATOR_H_INCLUDED
+#define INTEGRATOR_H_INCLUDED
+
+// Host-side integration of recorded waveforms.
+//
+// Unlike ADC_INT, which gives a single integral per measurement, the waveform
+// is integrated over any number of gates. A baseline window can be subtracted
+// from the gates, the total stays raw like ADC_INT. Gates with more than one
+// pulse are flagged as pile-up.
+// All gates are computed from a single prefix sum of the waveform.
+//
+// An integrator holds scratch buffers and must not be shared between threads.
+
+#include <stdint.h>
+
+#define INTEGRATOR_MAX_GATES 16
+
+// VSDC4 records this many samples after the stop of measurement
+#define INTEGRATOR_TAIL_SAMPLES 128
+
+// Window of samples [start, start + length), clipped to the waveform
+struct window {
+    uint32_t start;
+    uint32_t length;
+};
+
+struct integrator_config {
+    int ngates;
+    struct window gates[INTEGRATOR_MAX_GATES];
+    struct window baseline;   // Zero length - no baseline subtraction
+    float pileup_threshold;   // Pulse threshold above baseline in volts, 0 - disabled
+    double sample_period;     // Seconds per sample
+};
+
+struct integrator_result {
+    float baseline;           // Mean of the baseline window
+    float total;              // Raw integral of the measurement, comparable to ADC_INT
+    float gate[INTEGRATOR_MAX_GATES]; // Integrals with the baseline subtracted
+    uint32_t pileup_mask;     // Bit N is set if gate N contains more than one pulse
+};
+
+struct integrator {
+    const struct integrator_config *cfg;
+    double *prefix;
+    uint32_t capacity;
+};
+
+void integrator_init(struct integrator *in, const struct integrator_config *cfg);
+void integrator_destroy(struct integrator *in);
+
+// Integrate waveform of n samples, the last INTEGRATOR_TAIL_SAMPLES of which
+// were recorded after the stop and are excluded from the total.
+// Returns 0 or ENOMEM.
+int integrator_run(struct integrator *in, const float *wave, uint32_t n,
+                   struct integrator_result *res);
+
+// p[i] = x[0] + ... + x[i - 1], p must have room for n + 1 values
+void prefix_sum(const float *x, uint32_t n, double *p);
+
+// Max relative deviation of integrator_check results
+#define INTEGRATOR_CHECK_TOLERANCE 1e-4
+
+// Integrate a simulated waveform (baseline, exponential pulses and a pulse
+// after the stop) with a baseline window configured. The total is compared
+// with the ADC_INT the board would report for it, gates and pile-up flags
+// with the signal above the baseline. Deviations are printed to stderr.
+// Run by "test --check", see main.c.
+// Returns 0, ENOMEM or ERANGE if a result is out of tolerance.
+int integrator_check(void);
+
+#endif
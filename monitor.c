@@ -0,0 +1,308 @@
+#include "monitor.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "vsdc4.h"
+#include "timing.h"
+
+static const uint32_t error_bits[MONITOR_NERRORS] = {
+    ADC_CSR_OVRNG, ADC_CSR_MEM_OVF, ADC_CSR_MISS_INT, ADC_CSR_MISS_START
+};
+
+static const char *error_names[MONITOR_NERRORS] = {
+    "OVRNG", "MEM_OVF", "MISS_INT", "MISS_START"
+};
+
+#define ERROR_MASK (ADC_CSR_OVRNG | ADC_CSR_MEM_OVF | ADC_CSR_MISS_INT | ADC_CSR_MISS_START)
+
+// Status of a channel, shared by the acquisition and the monitor thread
+// and accessed atomically.
+// Error bits are sticky until the next arm, so a bit is counted once per
+// measurement, whether the acquisition or the monitor saw it first.
+struct noted_channel {
+    uint32_t csr;          // Reported by the acquisition
+    uint64_t time_ns;      // 0 if nothing was reported yet
+    // Arm generation << 32 | error bits counted in the current measurement,
+    // the generation is odd while the channel is being armed
+    uint64_t counted;
+    unsigned long errors[MONITOR_NERRORS];
+};
+
+struct monitor {
+    const struct monitor_config *cfg;
+    int nboards;
+    struct monitor_target targets[MONITOR_MAX_BOARDS];
+    struct noted_channel noted[MONITOR_MAX_BOARDS][GROUP_MAX_CHANNELS];
+
+    // Owned by the monitor thread
+    struct monitor_snapshot work;
+    double busy;           // Seconds the bus was locked, without waiting for the lock
+    double last_sample;
+
+    // Published snapshot, odd seq means that it is being written
+    unsigned seq;
+    struct monitor_snapshot published;
+
+    pthread_t thread;
+    pthread_mutex_t mutex; // Protects stop only, used for interruptible sleep
+    pthread_cond_t cond;
+    int stop;
+    int running;
+    double started;
+};
+
+int monitor_init(monitor **pm, const struct monitor_config *cfg,
+                 int nboards, const struct monitor_target *targets) {
+    if (nboards > MONITOR_MAX_BOARDS)
+        return EINVAL;
+    monitor *m = (monitor *) calloc(1, sizeof(monitor));
+    if (m == NULL)
+        return ENOMEM;
+    int err = pthread_mutex_init(&m->mutex, NULL);
+    if (err) {
+        free(m);
+        return err;
+    }
+    pthread_cond_init(&m->cond, NULL);
+
+    m->cfg = cfg;
+    m->nboards = nboards;
+    memcpy(m->targets, targets, nboards * sizeof(struct monitor_target));
+    m->work.nboards = nboards;
+    for (int b = 0; b < nboards; b++)
+        m->work.boards[b].ch_mask = targets[b].ch_mask;
+    m->work.interval = cfg->interval;
+    m->published = m->work;
+    *pm = m;
+    return 0;
+}
+
+void monitor_end(monitor *m) {
+    pthread_cond_destroy(&m->cond);
+    pthread_mutex_destroy(&m->mutex);
+    free(m);
+}
+
+// Count error bits of csr not yet counted in measurement gen.
+// Does nothing if the channel has been armed again since gen was taken.
+static void count_errors(struct noted_channel *n, uint32_t gen, uint32_t csr) {
+    uint64_t old = __atomic_load_n(&n->counted, __ATOMIC_ACQUIRE);
+    uint64_t updated;
+    do {
+        if ((uint32_t)(old >> 32) != gen)
+            return;
+        updated = old | (csr & ERROR_MASK);
+        if (updated == old)
+            return;
+    } while (!__atomic_compare_exchange_n(&n->counted, &old, updated, 0,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    uint32_t raised = (uint32_t)(updated & ~old);
+    for (int e = 0; e < MONITOR_NERRORS; e++)
+        if (raised & error_bits[e])
+            __atomic_add_fetch(&n->errors[e], 1, __ATOMIC_RELAXED);
+}
+
+// Start the next generation with no errors counted
+static void next_generation(monitor *m, int board, uint8_t ch_mask) {
+    for (int ch = 0; ch < GROUP_MAX_CHANNELS; ch++) {
+        if (!(ch_mask & (1 << ch)))
+            continue;
+        uint64_t *counted = &m->noted[board][ch].counted;
+        uint64_t old = __atomic_load_n(counted, __ATOMIC_ACQUIRE);
+        while (!__atomic_compare_exchange_n(counted, &old, ((old >> 32) + 1) << 32, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            ;
+    }
+}
+
+void monitor_arm_begin(monitor *m, int board, uint8_t ch_mask) {
+    next_generation(m, board, ch_mask);
+}
+
+void monitor_arm_end(monitor *m, int board, uint8_t ch_mask) {
+    next_generation(m, board, ch_mask);
+}
+
+void monitor_note_csr(monitor *m, int board, int ch, uint32_t csr) {
+    struct noted_channel *n = &m->noted[board][ch];
+    __atomic_store_n(&n->csr, csr, __ATOMIC_RELAXED);
+    uint64_t counted = __atomic_load_n(&n->counted, __ATOMIC_ACQUIRE);
+    count_errors(n, (uint32_t)(counted >> 32), csr);
+    __atomic_store_n(&n->time_ns, (uint64_t)(now() * 1e9), __ATOMIC_RELEASE);
+}
+
+static void publish(monitor *m) {
+    unsigned seq = m->seq;
+    __atomic_store_n(&m->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&m->published, &m->work, sizeof(m->published));
+    __atomic_store_n(&m->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void monitor_get_snapshot(monitor *m, struct monitor_snapshot *s) {
+    for (;;) {
+        unsigned seq = __atomic_load_n(&m->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+        memcpy(s, &m->published, sizeof(*s));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&m->seq, __ATOMIC_RELAXED) == seq)
+            return;
+    }
+}
+
+static void sample_board(monitor *m, int b, double t, double dt) {
+    const struct monitor_target *target = &m->targets[b];
+    struct monitor_board *board = &m->work.boards[b];
+
+    // GSR, INT_BUFF_STATUS and statuses the acquisition did not report recently
+    uint32_t addrs[2 + GROUP_MAX_CHANNELS];
+    uint32_t data[2 + GROUP_MAX_CHANNELS];
+    int n = 0;
+    addrs[n++] = target->base + GSR;
+    addrs[n++] = target->base + INT_BUFF_STATUS;
+    uint8_t poll_mask = 0;
+    uint32_t gen[GROUP_MAX_CHANNELS];
+    for (int ch = 0; ch < GROUP_MAX_CHANNELS; ch++) {
+        if (!(target->ch_mask & (1 << ch)))
+            continue;
+        struct noted_channel *noted = &m->noted[b][ch];
+        uint64_t noted_ns = __atomic_load_n(&noted->time_ns, __ATOMIC_ACQUIRE);
+        if (noted_ns && t - noted_ns * 1e-9 < m->work.interval) {
+            board->ch[ch].csr = __atomic_load_n(&noted->csr, __ATOMIC_RELAXED);
+            m->work.csr_skipped++;
+            continue;
+        }
+        // Taken before the read: if the channel is armed meanwhile,
+        // the value belongs to the previous measurement and is not counted
+        gen[ch] = (uint32_t)(__atomic_load_n(&noted->counted, __ATOMIC_ACQUIRE) >> 32);
+        poll_mask |= 1 << ch;
+        addrs[n++] = target->base + getChannelRegistersOffset(ch) + ADC_CSR;
+    }
+
+    double hold;
+    board->read_error = cv_read_multi_timed(target->dev, addrs, data, n, &hold);
+    m->busy += hold;
+
+    if (!board->read_error) {
+        board->gsr = data[0];
+        board->int_buff_status = data[1];
+        uint32_t *p = data + 2;
+        for (int ch = 0; ch < GROUP_MAX_CHANNELS; ch++) {
+            if (!(poll_mask & (1 << ch)))
+                continue;
+            uint32_t csr = *p++;
+            if (!(gen[ch] & 1))
+                count_errors(&m->noted[b][ch], gen[ch], csr);
+            board->ch[ch].csr = csr;
+            m->work.csr_reads++;
+        }
+    }
+
+    for (int ch = 0; ch < GROUP_MAX_CHANNELS; ch++) {
+        struct monitor_channel *c = &board->ch[ch];
+        for (int e = 0; e < MONITOR_NERRORS; e++) {
+            unsigned long total = __atomic_load_n(&m->noted[b][ch].errors[e], __ATOMIC_RELAXED);
+            c->error_rate[e] = dt > 0 ? (total - c->errors[e]) / dt : 0;
+            c->errors[e] = total;
+        }
+    }
+}
+
+static void sample(monitor *m) {
+    double t = now();
+    double dt = t - m->last_sample;
+    m->last_sample = t;
+
+    double busy = m->busy;
+    for (int b = 0; b < m->nboards; b++)
+        sample_board(m, b, t, dt);
+    double sample_busy = m->busy - busy;
+
+    // Keep the share of bus time under the limit
+    double interval = m->cfg->interval;
+    if (m->cfg->max_bus_share > 0 && sample_busy / m->cfg->max_bus_share > interval)
+        interval = sample_busy / m->cfg->max_bus_share;
+
+    m->work.samples++;
+    m->work.time = now() - m->started;
+    m->work.interval = interval;
+    m->work.bus_share = m->work.time > 0 ? m->busy / m->work.time : 0;
+    publish(m);
+}
+
+static void *monitor_main(void *arg) {
+    monitor *m = (monitor *)arg;
+
+    pthread_mutex_lock(&m->mutex);
+    while (!m->stop) {
+        pthread_mutex_unlock(&m->mutex);
+        sample(m);
+        pthread_mutex_lock(&m->mutex);
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        double interval = m->work.interval;
+        deadline.tv_sec += (time_t)interval;
+        deadline.tv_nsec += (long)((interval - (time_t)interval) * 1e9);
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        while (!m->stop && pthread_cond_timedwait(&m->cond, &m->mutex, &deadline) != ETIMEDOUT)
+            ;
+    }
+    pthread_mutex_unlock(&m->mutex);
+    return NULL;
+}
+
+int monitor_start(monitor *m) {
+    m->started = m->last_sample = now();
+    int err = pthread_create(&m->thread, NULL, monitor_main, m);
+    if (!err)
+        m->running = 1;
+    return err;
+}
+
+void monitor_stop(monitor *m) {
+    if (!m->running)
+        return;
+    pthread_mutex_lock(&m->mutex);
+    m->stop = 1;
+    pthread_cond_signal(&m->cond);
+    pthread_mutex_unlock(&m->mutex);
+    pthread_join(m->thread, NULL);
+    m->running = 0;
+}
+
+void monitor_print(const struct monitor_snapshot *s, FILE *f) {
+    fprintf(f, "monitor: %lu samples, interval %.3f s, bus share %.3f%%, "
+               "ADC_CSR %lu read, %lu taken from acquisition\n",
+            s->samples, s->interval, s->bus_share * 100, s->csr_reads, s->csr_skipped);
+    for (int b = 0; b < s->nboards; b++) {
+        const struct monitor_board *board = &s->boards[b];
+        if (board->read_error) {
+            fprintf(f, "board%d: read failed, error %d\n", b, board->read_error);
+            continue;
+        }
+        fprintf(f, "board%d: GSR 0x%08X INT_BUFF_STATUS 0x%08X\n",
+                b, board->gsr, board->int_buff_status);
+        for (int ch = 0; ch < GROUP_MAX_CHANNELS; ch++) {
+            if (!(board->ch_mask & (1 << ch)))
+                continue;
+            const struct monitor_channel *c = &board->ch[ch];
+            fprintf(f, "  ch%d: CSR 0x%08X", ch, c->csr);
+            for (int e = 0; e < MONITOR_NERRORS; e++)
+                if (c->errors[e])
+                    fprintf(f, " %s %lu (%.2f/s)", error_names[e], c->errors[e], c->error_rate[e]);
+            fprintf(f, "\n");
+        }
+    }
+}
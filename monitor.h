@@ -0,0 +1,96 @@
+#ifndef MONITOR_H_INCLUDED
+#define MONITOR_H_INCLUDED
+
+// Board health monitor.
+//
+// A separate thread samples GSR, INT_BUFF_STATUS and ADC_CSR of every board
+// at a low rate with one batched read per board. ADC_CSR reads are skipped
+// for channels whose status the acquisition already reported with
+// monitor_note_csr during the last interval.
+// The share of wall time the monitor keeps the bus locked is measured,
+// and the interval is stretched so that it never exceeds max_bus_share.
+//
+// An error bit is counted once per measurement, whether it was noted by the
+// acquisition or polled by the monitor.
+//
+// Results are published as a snapshot protected by a sequence counter:
+// neither monitor_note_csr nor monitor_get_snapshot takes a lock,
+// so acquisition threads are never blocked by the monitor.
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "device_access.h"
+#include "vsdc_group.h"
+
+#define MONITOR_MAX_BOARDS 8
+
+// Error bits of ADC_CSR which are counted
+enum monitor_error {
+    MONITOR_OVRNG,
+    MONITOR_MEM_OVF,
+    MONITOR_MISS_INT,
+    MONITOR_MISS_START,
+    MONITOR_NERRORS
+};
+
+struct monitor_config {
+    double interval;        // Seconds between samples
+    double max_bus_share;   // Max fraction of time spent reading the bus
+};
+
+// Board to watch
+struct monitor_target {
+    device *dev;
+    uint32_t base;
+    uint8_t ch_mask;
+};
+
+struct monitor_channel {
+    uint32_t csr;           // Last observed ADC_CSR
+    unsigned long errors[MONITOR_NERRORS];
+    double error_rate[MONITOR_NERRORS]; // Errors per second during the last interval
+};
+
+struct monitor_board {
+    uint8_t ch_mask;
+    uint32_t gsr;
+    uint32_t int_buff_status;
+    int read_error;         // Error code of the last sample
+    struct monitor_channel ch[GROUP_MAX_CHANNELS];
+};
+
+struct monitor_snapshot {
+    unsigned long samples;  // Number of published samples
+    double time;            // Seconds since monitor_start
+    double interval;        // Current interval after stretching
+    double bus_share;       // Fraction of time the monitor held the bus
+    unsigned long csr_reads;   // ADC_CSR values read by the monitor
+    unsigned long csr_skipped; // ADC_CSR reads saved thanks to the acquisition
+    int nboards;
+    struct monitor_board boards[MONITOR_MAX_BOARDS];
+};
+
+typedef struct monitor monitor;
+
+// Returns 0 or a system error code
+int monitor_init(monitor **pm, const struct monitor_config *cfg,
+                 int nboards, const struct monitor_target *targets);
+void monitor_end(monitor *m);
+
+int monitor_start(monitor *m);
+// Stop and join the monitor thread
+void monitor_stop(monitor *m);
+
+// Must surround clearing of result bits of the channels in ch_mask,
+// so that errors of the next measurement are counted again
+void monitor_arm_begin(monitor *m, int board, uint8_t ch_mask);
+void monitor_arm_end(monitor *m, int board, uint8_t ch_mask);
+
+// Report ADC_CSR the acquisition has read for the measurement
+void monitor_note_csr(monitor *m, int board, int ch, uint32_t csr);
+
+void monitor_get_snapshot(monitor *m, struct monitor_snapshot *s);
+void monitor_print(const struct monitor_snapshot *s, FILE *f);
+
+#endif
@@ -0,0 +1,839 @@
+#include "pipeline.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <math.h>
+
+#include <CAENVMElib.h>
+
+#include "vsdc4.h"
+#include "device_access.h"
+#include "queue.h"
+#include "capture.h"
+#include "replay.h"
+#include "monitor.h"
+#include "timing.h"
+
+// Size of a channel waveform buffer in samples
+#define MAX_WAVE_SAMPLES ((WAVEFORM1 - WAVEFORM0) / sizeof(float))
+
+// CAEN bridge, shared by all boards with the same link and board number
+struct bridge {
+    device *dev;
+    int link;
+    int bridge;
+};
+
+struct board {
+    const struct board_config *cfg;
+    struct vsdc_group group;
+    int bridge;
+    double last_start;     // Owned by trigger stage
+    struct event *pending; // Owned by dispatch stage
+    // Time of an IRQ that came before its event reached the dispatch stage,
+    // 0 if none. Owned by dispatch stage
+    double fired;
+    struct vsdc_group_stats stats; // Owned by sink stage
+    // Host-side integrals compared with ADC_INT, owned by sink stage
+    unsigned long compared;
+    double max_deviation;
+};
+
+struct worker {
+    pipeline *p;
+    enum stage stage;
+    pthread_t thread;
+    uint64_t busy_ns;      // Accessed atomically
+    double work_start;
+};
+
+struct output {
+    const struct output_config *cfg;
+    FILE *f;
+};
+
+struct pipeline {
+    const struct config *cfg;
+    int nbridges;
+    struct bridge bridges[CONFIG_MAX_BOARDS];
+    struct board boards[CONFIG_MAX_BOARDS];
+    struct output outputs[CONFIG_MAX_OUTPUTS];
+
+    // Input queue of every stage
+    struct queue queues[STAGE_COUNT];
+
+    int nworkers;
+    struct worker *workers;
+    int live[STAGE_COUNT]; // Running workers of every stage, accessed atomically
+    int running;           // Running workers in total, accessed atomically
+    int stopping;          // Accessed atomically
+    double started;
+
+    replay *source;        // Replay source, NULL for live acquisition
+    monitor *health;       // Status monitor, NULL if disabled
+
+    // Written by sink, accessed atomically
+    unsigned long events;
+    unsigned long samples;
+    double finished;       // Time the sink was done
+};
+
+static void sleep_until(double t) {
+    double dt = t - now();
+    if (dt <= 0)
+        return;
+    struct timespec ts;
+    ts.tv_sec = (time_t)dt;
+    ts.tv_nsec = (long)((dt - ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+}
+
+static int is_stopping(pipeline *p) {
+    return __atomic_load_n(&p->stopping, __ATOMIC_ACQUIRE);
+}
+
+// Busy time accounting, work is the time between taking an item
+// from the input queue and handing the result to the next stage
+static void work_begin(struct worker *w) {
+    w->work_start = now();
+}
+
+static void work_end(struct worker *w) {
+    uint64_t ns = (uint64_t)((now() - w->work_start) * 1e9);
+    __atomic_add_fetch(&w->busy_ns, ns, __ATOMIC_RELAXED);
+}
+
+// Pass event to the next stage, drop it if the stage is already closed
+static void forward(pipeline *p, enum stage stage, struct event *ev) {
+    if (queue_push(&p->queues[stage], ev))
+        event_free(ev);
+}
+
+// Free events left in a queue
+static void drain(struct queue *q) {
+    struct event *ev;
+    while (queue_try_pop(q, (void **)&ev) == 0)
+        event_free(ev);
+}
+
+// Gates are in samples, so the integrator must use the period the board records at
+static int check_sample_period(struct board *b, int index, double sample_period) {
+    for (int ch = 0; ch < GROUP_MAX_CHANNELS; ch++) {
+        if (!(b->cfg->wave_mask & (1 << ch)))
+            continue;
+        double period;
+        int err = group_sample_period(&b->group, ch, &period);
+        if (err) {
+            cv_perror("Reading sample period", err);
+            return err;
+        }
+        if (fabs(period - sample_period) > period * 1e-3) {
+            fprintf(stderr, "Board %d ch%d: integrator sample_period is %g s, "
+                            "board records a sample every %g s\n",
+                    index, ch, sample_period, period);
+            return EINVAL;
+        }
+    }
+    return 0;
+}
+
+// VSDC device information
+struct vsdc_version {
+    int swid;
+    int hwid;
+    int devid;
+};
+
+static void decode_vsdc_version(uint32_t device_id, struct vsdc_version *info) {
+    info->swid = device_id & 0xff;
+    info->hwid = (device_id >> 8) & 0xff;
+    info->devid = device_id >> 16;
+}
+
+static int print_board_info(device *dev, int index, uint32_t base) {
+    uint32_t device_id;
+    int err = cv_read(dev, base + DEV_ID, &device_id);
+    if (err)
+        return err;
+    struct vsdc_version info;
+    decode_vsdc_version(device_id, &info);
+
+    float voltage;
+    err = cv_read(dev, base + REF_H, (uint32_t *)&voltage);
+    if (err)
+        return err;
+
+    printf("Board %d at 0x%08X\n", index, base);
+    printf("Device: 0x%04X\n", info.devid);
+    printf("Hardware: 0x%02X\n", info.hwid);
+    printf("Software: 0x%02X\n", info.swid);
+    printf("REF_H: %f volts\n", voltage);
+    printf("\n");
+    return 0;
+}
+
+static int open_bridge(pipeline *p, const struct board_config *b) {
+    for (int i = 0; i < p->nbridges; i++)
+        if (p->bridges[i].link == b->link && p->bridges[i].bridge == b->bridge)
+            return i;
+
+    struct bridge *br = &p->bridges[p->nbridges];
+    int err = cv_init(&br->dev, b->link, b->bridge, cvIRQ5);
+    if (err) {
+        cv_perror("cv_init", err);
+        return -1;
+    }
+    br->link = b->link;
+    br->bridge = b->bridge;
+    return p->nbridges++;
+}
+
+static int open_outputs(pipeline *p) {
+    const struct config *cfg = p->cfg;
+    for (int i = 0; i < cfg->noutputs; i++) {
+        struct output *out = &p->outputs[i];
+        out->cfg = &cfg->outputs[i];
+        switch (out->cfg->type) {
+        case OUTPUT_STDOUT:
+            out->f = stdout;
+            break;
+        case OUTPUT_CSV:
+            out->f = fopen(out->cfg->path, "w");
+            if (out->f == NULL) {
+                int err = errno;
+                perror(out->cfg->path);
+                return err;
+            }
+            fprintf(out->f, "board,seq,ch,status,integral,skew,latency_us\n");
+            break;
+        case OUTPUT_GATES:
+            out->f = fopen(out->cfg->path, "w");
+            if (out->f == NULL) {
+                int err = errno;
+                perror(out->cfg->path);
+                return err;
+            }
+            fprintf(out->f, "board,seq,ch,baseline,total,gate,integral,pileup\n");
+            break;
+        case OUTPUT_CAPTURE:
+            out->f = fopen(out->cfg->path, "wb");
+            if (out->f == NULL) {
+                int err = errno;
+                perror(out->cfg->path);
+                return err;
+            }
+            if (capture_write_header(out->f)) {
+                perror(out->cfg->path);
+                return EIO;
+            }
+            break;
+        }
+    }
+    return 0;
+}
+
+int pipeline_init(pipeline **pp, const struct config *cfg) {
+    pipeline *p = (pipeline *) calloc(1, sizeof(pipeline));
+    if (p == NULL)
+        return ENOMEM;
+    p->cfg = cfg;
+
+    int err = 0;
+    if (cfg->replay.enabled) {
+        err = replay_open(&p->source, &cfg->replay);
+        if (err)
+            cv_perror(cfg->replay.path, err);
+    }
+    for (int i = 0; i < cfg->nboards && !err && !p->source; i++) {
+        const struct board_config *bc = &cfg->boards[i];
+        struct board *b = &p->boards[i];
+        b->cfg = bc;
+        b->bridge = open_bridge(p, bc);
+        if (b->bridge < 0) {
+            err = EIO;
+            break;
+        }
+        device *dev = p->bridges[b->bridge].dev;
+        err = print_board_info(dev, i, bc->base);
+        if (err) {
+            cv_perror("Reading board info", err);
+            break;
+        }
+        err = group_init(&b->group, dev, bc->base, bc->ch_mask,
+                         bc->start_src, bc->sync_mux, bc->ch, bc->vec);
+        if (err) {
+            cv_perror("Configuring group", err);
+            break;
+        }
+        if (cfg->integrate)
+            err = check_sample_period(b, i, cfg->integrator.sample_period);
+    }
+    if (!err && cfg->monitor && !p->source) {
+        struct monitor_target targets[CONFIG_MAX_BOARDS];
+        for (int i = 0; i < cfg->nboards; i++) {
+            targets[i].dev = p->bridges[p->boards[i].bridge].dev;
+            targets[i].base = cfg->boards[i].base;
+            targets[i].ch_mask = cfg->boards[i].ch_mask;
+        }
+        err = monitor_init(&p->health, &cfg->monitor_cfg, cfg->nboards, targets);
+        if (err)
+            cv_perror("monitor_init", err);
+    }
+    if (!err)
+        err = open_outputs(p);
+
+    // The arm queue holds at most one event per board
+    for (int i = 0; i < STAGE_COUNT && !err; i++) {
+        int size = cfg->queue_size;
+        if (i == STAGE_ARM && size < cfg->nboards)
+            size = cfg->nboards;
+        err = queue_init(&p->queues[i], size);
+        if (err) {
+            for (int j = 0; j < i; j++)
+                queue_destroy(&p->queues[j]);
+        }
+    }
+
+    if (err) {
+        for (int i = 0; i < cfg->noutputs; i++)
+            if (p->outputs[i].f && p->outputs[i].f != stdout)
+                fclose(p->outputs[i].f);
+        for (int i = 0; i < p->nbridges; i++)
+            cv_end(p->bridges[i].dev);
+        if (p->source)
+            replay_close(p->source);
+        if (p->health)
+            monitor_end(p->health);
+        free(p);
+        return err;
+    }
+
+    *pp = p;
+    return 0;
+}
+
+void pipeline_end(pipeline *p) {
+    // Events are left in queues of stages that never got their workers
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        drain(&p->queues[i]);
+        queue_destroy(&p->queues[i]);
+    }
+    for (int i = 0; i < p->cfg->noutputs; i++)
+        if (p->outputs[i].f != stdout)
+            fclose(p->outputs[i].f);
+    for (int i = 0; i < p->nbridges; i++)
+        cv_end(p->bridges[i].dev);
+    if (p->source)
+        replay_close(p->source);
+    if (p->health)
+        monitor_end(p->health);
+    free(p->workers);
+    free(p);
+}
+
+static void *arm_stage(struct worker *w) {
+    pipeline *p = w->p;
+    const struct config *cfg = p->cfg;
+    int finished = 0;
+
+    struct event *ev;
+    while (finished < cfg->nboards && queue_pop(&p->queues[STAGE_ARM], (void **)&ev) == 0) {
+        if (is_stopping(p)) {
+            event_free(ev);
+            break;
+        }
+        work_begin(w);
+        struct board *b = &p->boards[ev->board];
+        if (p->health)
+            monitor_arm_begin(p->health, ev->board, b->group.ch_mask);
+        int err = group_arm(&b->group);
+        if (p->health)
+            monitor_arm_end(p->health, ev->board, b->group.ch_mask);
+        if (err) {
+            cv_perror("ARM: Failed to arm group", err);
+            event_free(ev);
+            work_end(w);
+            pipeline_stop(p);
+            break;
+        }
+        ev->armed = now();
+        if (cfg->count && ev->seq + 1 == cfg->count)
+            finished++;
+        work_end(w);
+        forward(p, STAGE_TRIGGER, ev);
+    }
+
+    // Readout will not be able to request more measurements
+    queue_close(&p->queues[STAGE_ARM]);
+    drain(&p->queues[STAGE_ARM]);
+    return NULL;
+}
+
+static void *trigger_stage(struct worker *w) {
+    pipeline *p = w->p;
+
+    struct event *ev;
+    while (queue_pop(&p->queues[STAGE_TRIGGER], (void **)&ev) == 0) {
+        if (is_stopping(p)) {
+            event_free(ev);
+            continue;
+        }
+        struct board *b = &p->boards[ev->board];
+        if (b->group.start_src == ADC_START_SRC_PROG) {
+            sleep_until(b->last_start + p->cfg->period);
+            work_begin(w);
+            int err = group_start(&b->group);
+            if (err) {
+                cv_perror("TRIGGER: Failed to start group", err);
+                event_free(ev);
+                work_end(w);
+                pipeline_stop(p);
+                continue;
+            }
+            ev->started = b->last_start = now();
+            work_end(w);
+        } else {
+            // Started by the external source at unknown moment
+            ev->started = ev->armed;
+        }
+        forward(p, STAGE_DISPATCH, ev);
+    }
+    return NULL;
+}
+
+static int has_pending(pipeline *p) {
+    for (int i = 0; i < p->cfg->nboards; i++)
+        if (p->boards[i].pending)
+            return 1;
+    return 0;
+}
+
+static void *dispatch_stage(struct worker *w) {
+    pipeline *p = w->p;
+    const struct config *cfg = p->cfg;
+    struct queue *in = &p->queues[STAGE_DISPATCH];
+    int closed = 0;
+
+    for (;;) {
+        // Collect started measurements, block only if there is nothing to wait for
+        struct event *ev;
+        int err;
+        while ((err = has_pending(p) ? queue_try_pop(in, (void **)&ev) : queue_pop(in, (void **)&ev)) == 0) {
+            struct board *b = &p->boards[ev->board];
+            if (b->fired) {
+                // The measurement finished before the event got here
+                ev->irq = b->fired;
+                b->fired = 0;
+                forward(p, STAGE_READOUT, ev);
+            } else {
+                b->pending = ev;
+            }
+        }
+        if (err == ECANCELED)
+            closed = 1;
+        if (closed && (!has_pending(p) || is_stopping(p)))
+            break;
+
+        work_begin(w);
+        int handled = 0;
+        for (int i = 0; i < p->nbridges; i++) {
+            uint8_t vec;
+            err = cv_get_irq_vector(p->bridges[i].dev, &vec);
+            if (err) {
+                cv_perror("DISPATCH: get irq failed", err);
+                continue;
+            }
+            if (!vec)
+                continue;
+
+            struct board *b = NULL;
+            for (int j = 0; j < cfg->nboards; j++)
+                if (p->boards[j].bridge == i && p->boards[j].group.vec == vec)
+                    b = &p->boards[j];
+            if (b == NULL) {
+                fprintf(stderr, "DISPATCH: unexpected vector 0x%02X\n", vec);
+                continue;
+            }
+            // A board has at most one measurement in flight,
+            // so the IRQ belongs to the event that is still in the queues
+            if (b->pending == NULL) {
+                b->fired = now();
+                continue;
+            }
+            ev = b->pending;
+            b->pending = NULL;
+            ev->irq = now();
+            forward(p, STAGE_READOUT, ev);
+            handled++;
+        }
+        work_end(w);
+        if (!handled && cfg->irq_poll_us)
+            usleep(cfg->irq_poll_us);
+    }
+
+    for (int i = 0; i < cfg->nboards; i++) {
+        event_free(p->boards[i].pending);
+        p->boards[i].pending = NULL;
+    }
+    return NULL;
+}
+
+static void *readout_stage(struct worker *w) {
+    pipeline *p = w->p;
+    const struct config *cfg = p->cfg;
+
+    struct event *ev;
+    while (queue_pop(&p->queues[STAGE_READOUT], (void **)&ev) == 0) {
+        work_begin(w);
+        struct board *b = &p->boards[ev->board];
+        int err = group_read(&b->group, &ev->res);
+        ev->measured = !err;
+        // Let the monitor skip statuses the acquisition has just read
+        for (int ch = 0; ch < GROUP_MAX_CHANNELS && !err && p->health; ch++)
+            if (b->group.ch_mask & (1 << ch))
+                monitor_note_csr(p->health, ev->board, ch, ev->res.status[ch]);
+        for (int ch = 0; ch < GROUP_MAX_CHANNELS && !err; ch++) {
+            if (!(b->cfg->wave_mask & b->group.ch_mask & (1 << ch)))
+                continue;
+            uint32_t samples = ev->res.samples[ch];
+            if (samples > MAX_WAVE_SAMPLES)
+                samples = MAX_WAVE_SAMPLES;
+            err = event_alloc_wave(ev, ch, samples);
+            if (!err && samples)
+                err = group_read_waveform(&b->group, ch, samples, ev->wave[ch]);
+        }
+        ev->read = now();
+        work_end(w);
+        if (err) {
+            cv_perror("READOUT: Failed to read group", err);
+            event_free(ev);
+            pipeline_stop(p);
+            continue;
+        }
+
+        // Request the next measurement of this board
+        if (!is_stopping(p) && (cfg->count == 0 || ev->seq + 1 < cfg->count)) {
+            struct event *next = event_new(ev->board, b->group.ch_mask, ev->seq + 1);
+            if (next)
+                forward(p, STAGE_ARM, next);
+        }
+        forward(p, STAGE_PROCESS, ev);
+    }
+    return NULL;
+}
+
+// Events are independent, so several process workers integrate
+// waveforms of different measurements in parallel
+static void *process_stage(struct worker *w) {
+    pipeline *p = w->p;
+    struct integrator integrator;
+    integrator_init(&integrator, &p->cfg->integrator);
+
+    struct event *ev;
+    while (queue_pop(&p->queues[STAGE_PROCESS], (void **)&ev) == 0) {
+        work_begin(w);
+        for (int ch = 0; ch < GROUP_MAX_CHANNELS; ch++) {
+            // Integral is meaningful only if it is ready
+            if (!(ev->res.ready_mask & (1 << ch)))
+                ev->res.integral[ch] = 0;
+
+            if (!p->cfg->integrate || ev->wave[ch] == NULL)
+                continue;
+            int err = integrator_run(&integrator, ev->wave[ch], ev->nwave[ch], &ev->host[ch]);
+            if (err)
+                cv_perror("PROCESS: Failed to integrate waveform", err);
+            else
+                ev->host_mask |= 1 << ch;
+        }
+        work_end(w);
+        forward(p, STAGE_SINK, ev);
+    }
+
+    integrator_destroy(&integrator);
+    return NULL;
+}
+
+// Replay recorded events at the configured rate
+static void *replay_stage(struct worker *w) {
+    pipeline *p = w->p;
+    double speed = p->cfg->replay.speed;
+    double start = now();
+
+    while (!is_stopping(p)) {
+        struct event *ev = event_new(0, 0, 0);
+        if (ev == NULL) {
+            cv_perror("REPLAY", ENOMEM);
+            break;
+        }
+        double t;
+        work_begin(w);
+        int err = replay_next(p->source, ev, &t);
+        work_end(w);
+        if (err == 0 && (ev->board < 0 || ev->board >= CONFIG_MAX_BOARDS))
+            err = EIO;
+        if (err) {
+            if (err != ENODATA)
+                cv_perror("REPLAY: Failed to read recorded event", err);
+            event_free(ev);
+            break;
+        }
+
+        double at = speed > 0 ? start + t / speed : now();
+        if (speed > 0)
+            sleep_until(at);
+        // Move the recorded timestamps to the replay time, keeping the latencies
+        double shift = at - ev->started;
+        ev->armed += shift;
+        ev->started += shift;
+        ev->irq += shift;
+        ev->read += shift;
+        forward(p, STAGE_PROCESS, ev);
+    }
+    return NULL;
+}
+
+static void write_event(struct output *out, double t0, int ngates, const struct event *ev) {
+    if (out->cfg->type == OUTPUT_CAPTURE) {
+        if (capture_write(out->f, ev, t0))
+            perror(out->cfg->path);
+        return;
+    }
+
+    const struct vsdc_group_result *res = &ev->res;
+    double latency = (ev->read - ev->started) * 1e6;
+    char skew[16] = "";
+    if (res->skew != GROUP_SKEW_NOT_MEASURED)
+        snprintf(skew, sizeof(skew), "%u", res->skew);
+    for (int ch = 0; ch < GROUP_MAX_CHANNELS; ch++) {
+        if (!(ev->ch_mask & (1 << ch)))
+            continue;
+        switch (out->cfg->type) {
+        case OUTPUT_STDOUT:
+            if (res->ready_mask & (1 << ch))
+                printf("board%d #%lu ch%d: %.4e\n", ev->board, ev->seq, ch, res->integral[ch]);
+            else
+                printf("board%d #%lu ch%d: integral is NOT ready (status 0x%08X)\n",
+                       ev->board, ev->seq, ch, res->status[ch]);
+            break;
+        case OUTPUT_CSV:
+            fprintf(out->f, "%d,%lu,%d,0x%08X,%e,%s,%.1f\n", ev->board, ev->seq, ch,
+                    res->status[ch], res->integral[ch], skew, latency);
+            break;
+        case OUTPUT_GATES:
+            if (!(ev->host_mask & (1 << ch)))
+                break;
+            for (int g = 0; g < ngates; g++) {
+                const struct integrator_result *h = &ev->host[ch];
+                fprintf(out->f, "%d,%lu,%d,%e,%e,%d,%e,%d\n", ev->board, ev->seq, ch,
+                        h->baseline, h->total, g, h->gate[g], (h->pileup_mask >> g) & 1);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+static void *sink_stage(struct worker *w) {
+    pipeline *p = w->p;
+
+    struct event *ev;
+    while (queue_pop(&p->queues[STAGE_SINK], (void **)&ev) == 0) {
+        work_begin(w);
+        struct board *b = &p->boards[ev->board];
+        // Waveforms replayed from csv have no results of the board
+        if (ev->measured)
+            group_stats_add(&b->stats, ev->ch_mask, &ev->res);
+        for (int ch = 0; ch < GROUP_MAX_CHANNELS; ch++) {
+            if (!(ev->host_mask & ev->res.ready_mask & (1 << ch)))
+                continue;
+            double hw = ev->res.integral[ch];
+            double dev = fabs(ev->host[ch].total - hw) / (fabs(hw) > 1e-30 ? fabs(hw) : 1e-30);
+            if (dev > b->max_deviation)
+                b->max_deviation = dev;
+            b->compared++;
+        }
+        for (int i = 0; i < p->cfg->noutputs; i++)
+            write_event(&p->outputs[i], p->started, p->cfg->integrator.ngates, ev);
+
+        unsigned long samples = 0;
+        for (int ch = 0; ch < GROUP_MAX_CHANNELS; ch++)
+            if (ev->wave[ch])
+                samples += ev->nwave[ch];
+        __atomic_add_fetch(&p->events, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&p->samples, samples, __ATOMIC_RELAXED);
+
+        event_free(ev);
+        work_end(w);
+    }
+    p->finished = now();
+    for (int i = 0; i < p->cfg->noutputs; i++)
+        fflush(p->outputs[i].f);
+    for (int i = 0; i < CONFIG_MAX_BOARDS; i++) {
+        if (p->boards[i].stats.count == 0)
+            continue;
+        printf("Board %d: ", i);
+        group_stats_print(&p->boards[i].stats);
+        if (p->boards[i].compared)
+            printf("host integral vs ADC_INT: %lu compared, max deviation %.3g%%\n",
+                   p->boards[i].compared, p->boards[i].max_deviation * 100);
+    }
+    return NULL;
+}
+
+typedef void *(*stage_func)(struct worker *w);
+
+static const stage_func stage_funcs[STAGE_COUNT] = {
+    arm_stage, trigger_stage, dispatch_stage, readout_stage, process_stage, sink_stage
+};
+
+// Number of worker threads of the stage
+static int stage_threads(pipeline *p, int stage) {
+    if (p->source && stage < STAGE_READOUT)
+        return 0;
+    return p->cfg->stages[stage].threads;
+}
+
+static void *worker_main(void *arg) {
+    struct worker *w = (struct worker *)arg;
+    pipeline *p = w->p;
+    if (p->source && w->stage == STAGE_READOUT)
+        replay_stage(w);
+    else
+        stage_funcs[w->stage](w);
+
+    // The last worker of a stage closes the next one
+    if (__atomic_sub_fetch(&p->live[w->stage], 1, __ATOMIC_ACQ_REL) == 0 && w->stage + 1 < STAGE_COUNT)
+        queue_close(&p->queues[w->stage + 1]);
+    __atomic_sub_fetch(&p->running, 1, __ATOMIC_ACQ_REL);
+    return NULL;
+}
+
+int pipeline_start(pipeline *p) {
+    const struct config *cfg = p->cfg;
+
+    // nworkers counts only started threads, so pipeline_wait is safe after a failure
+    p->nworkers = 0;
+    int total = 0;
+    for (int i = 0; i < STAGE_COUNT; i++)
+        total += stage_threads(p, i);
+    p->workers = (struct worker *) calloc(total, sizeof(struct worker));
+    if (p->workers == NULL)
+        return ENOMEM;
+
+    // First measurement of every board
+    for (int i = 0; i < cfg->nboards && !p->source; i++) {
+        struct event *ev = event_new(i, p->boards[i].group.ch_mask, 0);
+        if (ev == NULL)
+            return ENOMEM;
+        queue_push(&p->queues[STAGE_ARM], ev);
+    }
+
+    p->started = now();
+    if (p->health) {
+        int err = monitor_start(p->health);
+        if (err)
+            return err;
+    }
+    int n = 0;
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        const struct stage_config *sc = &cfg->stages[s];
+        char msg[64];
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        if (sc->cpu >= 0) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(sc->cpu, &cpus);
+            int err = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+            if (err) {
+                snprintf(msg, sizeof(msg), "Stage %s: failed to pin to CPU %d", stage_names[s], sc->cpu);
+                cv_perror(msg, err);
+                pthread_attr_destroy(&attr);
+                pipeline_stop(p);
+                for (int j = s; j < STAGE_COUNT; j++)
+                    queue_close(&p->queues[j]);
+                return err;
+            }
+        }
+        for (int i = 0; i < stage_threads(p, s); i++, n++, p->nworkers++) {
+            struct worker *w = &p->workers[n];
+            w->p = p;
+            w->stage = (enum stage)s;
+            __atomic_add_fetch(&p->live[s], 1, __ATOMIC_ACQ_REL);
+            __atomic_add_fetch(&p->running, 1, __ATOMIC_ACQ_REL);
+            int err = pthread_create(&w->thread, &attr, worker_main, w);
+            if (err) {
+                snprintf(msg, sizeof(msg), "Stage %s: failed to start worker", stage_names[s]);
+                cv_perror(msg, err);
+                __atomic_sub_fetch(&p->live[s], 1, __ATOMIC_ACQ_REL);
+                __atomic_sub_fetch(&p->running, 1, __ATOMIC_ACQ_REL);
+                pthread_attr_destroy(&attr);
+                // Shut down already started workers
+                pipeline_stop(p);
+                for (int j = s; j < STAGE_COUNT; j++)
+                    if (p->live[j] == 0)
+                        queue_close(&p->queues[j]);
+                return err;
+            }
+        }
+        pthread_attr_destroy(&attr);
+    }
+    return 0;
+}
+
+void pipeline_stop(pipeline *p) {
+    __atomic_store_n(&p->stopping, 1, __ATOMIC_RELEASE);
+    queue_close(&p->queues[STAGE_ARM]);
+}
+
+int pipeline_done(pipeline *p) {
+    return __atomic_load_n(&p->running, __ATOMIC_ACQUIRE) == 0;
+}
+
+void pipeline_wait(pipeline *p) {
+    for (int i = 0; i < p->nworkers; i++)
+        pthread_join(p->workers[i].thread, NULL);
+    if (p->health)
+        monitor_stop(p->health);
+}
+
+void pipeline_print_stats(pipeline *p, FILE *f) {
+    double elapsed = (pipeline_done(p) ? p->finished : now()) - p->started;
+    fprintf(f, "%-9s %7s %6s %13s %7s %10s %10s\n",
+            "stage", "threads", "busy", "queue avg/max", "size", "full_wait", "empty_wait");
+    int n = 0;
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        int threads = stage_threads(p, s);
+        if (threads == 0)
+            continue;
+        uint64_t busy_ns = 0;
+        for (int i = 0; i < threads && n < p->nworkers; i++, n++)
+            busy_ns += __atomic_load_n(&p->workers[n].busy_ns, __ATOMIC_RELAXED);
+        double busy = elapsed > 0 ? busy_ns * 1e-9 / elapsed / threads : 0;
+
+        struct queue_stats qs;
+        queue_get_stats(&p->queues[s], &qs);
+        const char *name = p->source && s == STAGE_READOUT ? "replay" : stage_names[s];
+        fprintf(f, "%-9s %7d %5.1f%% %8.2f/%-4d %7d %10lu %10lu\n",
+                name, threads, busy * 100, qs.avg_size, qs.max_size,
+                qs.capacity, qs.full_waits, qs.empty_waits);
+    }
+
+    unsigned long events = __atomic_load_n(&p->events, __ATOMIC_RELAXED);
+    unsigned long samples = __atomic_load_n(&p->samples, __ATOMIC_RELAXED);
+    if (elapsed > 0)
+        fprintf(f, "%lu events in %.3f s: %.0f events/s, %.2f MS/s\n",
+                events, elapsed, events / elapsed, samples / elapsed * 1e-6);
+
+    if (p->health) {
+        struct monitor_snapshot snapshot;
+        monitor_get_snapshot(p->health, &snapshot);
+        monitor_print(&snapshot, f);
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef PIPELINE_H_INCLUDED
+#define PIPELINE_H_INCLUDED
+
+// Acquisition pipeline built from a config (see config.h).
+//
+// Every board is measured as one channel group (see vsdc_group.h).
+// A measurement travels through the stages as a struct event:
+//
+//   arm -> trigger -> dispatch -> readout -> process -> sink
+//
+//   arm       clears result bits of the group
+//   trigger   starts the group if the start source is program,
+//             otherwise the group waits for the external start
+//   dispatch  polls IRQ of every bridge and routes vectors to boards
+//   readout   reads the whole group in one batched transaction,
+//             block-reads waveforms of channels with waveform = 1
+//             and requests the next measurement of the board
+//   process   decodes results and integrates waveforms (see integrator.h)
+//   sink      writes results to the configured outputs
+//
+// If [monitor] is configured, a status monitor (see monitor.h) runs next to
+// the stages and takes ADC_CSR values from the readout.
+//
+// In replay mode (see replay.h) the readout stage is the replay source
+// and arm, trigger and dispatch stages have no threads.
+//
+// Every stage has its own bounded input queue and one or more worker threads.
+// A stage closes the queue of the next stage when its last worker exits,
+// so the pipeline shuts down from the head to the tail without losing events.
+//
+// pipeline_stop, pipeline_done and pipeline_print_stats are thread-safe,
+// other functions must be called from a single thread.
+
+#include <stdio.h>
+
+#include "config.h"
+#include "event.h"
+
+typedef struct pipeline pipeline;
+
+// Connect to all boards and configure them.
+// cfg must stay valid until pipeline_end.
+int pipeline_init(pipeline **pp, const struct config *cfg);
+void pipeline_end(pipeline *p);
+
+int pipeline_start(pipeline *p);
+// Ask the pipeline to stop, events that are already measured are still written.
+void pipeline_stop(pipeline *p);
+// Returns non-zero when all stage threads have finished.
+int pipeline_done(pipeline *p);
+// Join all stage threads.
+void pipeline_wait(pipeline *p);
+
+// Print occupancy of every stage queue, the share of time
+// every stage spent doing work instead of waiting, the throughput of the sink
+// and the latest status monitor snapshot.
+void pipeline_print_stats(pipeline *p, FILE *f);
+
+#endif
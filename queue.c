@@ -0,0 +1,133 @@
+#include "queue.h"
+
+#include <stdlib.h>
+#include <errno.h>
+
+#include "timing.h"
+
+// Must be called under lock before every size change
+static void account(struct queue *q) {
+    double t = now();
+    q->area += q->size * (t - q->last_change);
+    q->last_change = t;
+}
+
+int queue_init(struct queue *q, int capacity) {
+    if (capacity <= 0)
+        return EINVAL;
+    q->items = (void **) malloc(capacity * sizeof(void *));
+    if (q->items == NULL)
+        return ENOMEM;
+    int err = pthread_mutex_init(&q->mutex, NULL);
+    if (err) {
+        free(q->items);
+        return err;
+    }
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+
+    q->capacity = capacity;
+    q->head = 0;
+    q->size = 0;
+    q->closed = 0;
+    q->created = q->last_change = now();
+    q->area = 0;
+    q->max_size = 0;
+    q->pushes = 0;
+    q->full_waits = 0;
+    q->empty_waits = 0;
+    return 0;
+}
+
+void queue_destroy(struct queue *q) {
+    pthread_cond_destroy(&q->not_full);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_mutex_destroy(&q->mutex);
+    free(q->items);
+}
+
+int queue_push(struct queue *q, void *item) {
+    pthread_mutex_lock(&q->mutex);
+    if (q->size == q->capacity && !q->closed) {
+        q->full_waits++;
+        while (q->size == q->capacity && !q->closed)
+            pthread_cond_wait(&q->not_full, &q->mutex);
+    }
+    if (q->closed) {
+        pthread_mutex_unlock(&q->mutex);
+        return ECANCELED;
+    }
+
+    account(q);
+    q->items[(q->head + q->size) % q->capacity] = item;
+    q->size++;
+    q->pushes++;
+    if (q->size > q->max_size)
+        q->max_size = q->size;
+
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->mutex);
+    return 0;
+}
+
+// Must be called under lock with non-empty queue
+static void *take(struct queue *q) {
+    account(q);
+    void *item = q->items[q->head];
+    q->head = (q->head + 1) % q->capacity;
+    q->size--;
+    pthread_cond_signal(&q->not_full);
+    return item;
+}
+
+int queue_pop(struct queue *q, void **item) {
+    pthread_mutex_lock(&q->mutex);
+    if (q->size == 0 && !q->closed) {
+        q->empty_waits++;
+        while (q->size == 0 && !q->closed)
+            pthread_cond_wait(&q->not_empty, &q->mutex);
+    }
+    if (q->size == 0) {
+        pthread_mutex_unlock(&q->mutex);
+        return ECANCELED;
+    }
+
+    *item = take(q);
+    pthread_mutex_unlock(&q->mutex);
+    return 0;
+}
+
+int queue_try_pop(struct queue *q, void **item) {
+    pthread_mutex_lock(&q->mutex);
+    if (q->size == 0) {
+        int err = q->closed ? ECANCELED : EAGAIN;
+        pthread_mutex_unlock(&q->mutex);
+        return err;
+    }
+
+    *item = take(q);
+    pthread_mutex_unlock(&q->mutex);
+    return 0;
+}
+
+void queue_close(struct queue *q) {
+    pthread_mutex_lock(&q->mutex);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+void queue_get_stats(struct queue *q, struct queue_stats *stats) {
+    pthread_mutex_lock(&q->mutex);
+    account(q);
+    stats->capacity = q->capacity;
+    stats->size = q->size;
+    stats->max_size = q->max_size;
+    double elapsed = q->last_change - q->created;
+    stats->avg_size = elapsed > 0 ? q->area / elapsed : 0;
+    stats->pushes = q->pushes;
+    stats->full_waits = q->full_waits;
+    stats->empty_waits = q->empty_waits;
+    pthread_mutex_unlock(&q->mutex);
+}
@@ -0,0 +1,57 @@
+#ifndef QUEUE_H_INCLUDED
+#define QUEUE_H_INCLUDED
+
+// Bounded blocking FIFO of pointers used to connect pipeline stages.
+//
+// All functions except queue_init and queue_destroy are thread-safe.
+// Functions return 0 on success or a system error code.
+// A closed queue rejects pushes with ECANCELED,
+// pops drain remaining items and then fail with ECANCELED too.
+
+#include <pthread.h>
+
+struct queue {
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    void **items;
+    int capacity;
+    int head;
+    int size;
+    int closed;
+
+    // Statistics, protected by mutex
+    double created;
+    double last_change;
+    double area;          // Integral of size over time
+    int max_size;
+    unsigned long pushes;
+    unsigned long full_waits;  // Pushes that had to wait for free space
+    unsigned long empty_waits; // Pops that had to wait for an item
+};
+
+// Snapshot of queue statistics
+struct queue_stats {
+    int capacity;
+    int size;
+    int max_size;
+    double avg_size;   // Time-weighted average occupancy
+    unsigned long pushes;
+    unsigned long full_waits;
+    unsigned long empty_waits;
+};
+
+int queue_init(struct queue *q, int capacity);
+void queue_destroy(struct queue *q);
+
+int queue_push(struct queue *q, void *item);
+int queue_pop(struct queue *q, void **item);
+// Like queue_pop, but returns EAGAIN instead of waiting
+int queue_try_pop(struct queue *q, void **item);
+
+// Wake up all waiters, see above
+void queue_close(struct queue *q);
+
+void queue_get_stats(struct queue *q, struct queue_stats *stats);
+
+#endif
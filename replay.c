@@ -0,0 +1,149 @@
+#include "replay.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "capture.h"
+
+struct replay {
+    const struct replay_config *cfg;
+    unsigned long pass;  // Number of the current repeat
+
+    // Capture
+    FILE *f;
+    long data_start;     // Offset of the first record
+    double first_time;   // Start time of the first record of the file
+    double last_time;    // Start time of the last record read
+    unsigned long read;  // Records read in the current pass
+    unsigned long max_seq;
+    double offset;       // Time of the current pass
+
+    // CSV
+    float *wave;
+    uint32_t samples;
+};
+
+static int load_csv(replay *r) {
+    FILE *f = fopen(r->cfg->path, "r");
+    if (f == NULL)
+        return errno;
+
+    uint32_t capacity = 1024;
+    r->wave = (float *) malloc(capacity * sizeof(float));
+    if (r->wave == NULL) {
+        fclose(f);
+        return ENOMEM;
+    }
+    float val;
+    while (fscanf(f, "%f", &val) == 1) {
+        if (r->samples == capacity) {
+            capacity *= 2;
+            float *wave = (float *) realloc(r->wave, capacity * sizeof(float));
+            if (wave == NULL) {
+                fclose(f);
+                return ENOMEM;
+            }
+            r->wave = wave;
+        }
+        r->wave[r->samples++] = val;
+    }
+    int err = ferror(f) || !feof(f) ? EIO : 0;
+    fclose(f);
+    return err;
+}
+
+int replay_open(replay **pr, const struct replay_config *cfg) {
+    replay *r = (replay *) calloc(1, sizeof(replay));
+    if (r == NULL)
+        return ENOMEM;
+    r->cfg = cfg;
+
+    int err;
+    if (cfg->format == REPLAY_CSV) {
+        err = load_csv(r);
+    } else {
+        r->f = fopen(cfg->path, "rb");
+        if (r->f == NULL) {
+            err = errno;
+        } else {
+            err = capture_read_header(r->f);
+            r->data_start = ftell(r->f);
+        }
+    }
+    if (err) {
+        replay_close(r);
+        return err;
+    }
+    *pr = r;
+    return 0;
+}
+
+void replay_close(replay *r) {
+    if (r->f)
+        fclose(r->f);
+    free(r->wave);
+    free(r);
+}
+
+static int next_csv(replay *r, struct event *ev, double *t) {
+    const struct replay_config *cfg = r->cfg;
+    if (r->pass == cfg->repeat)
+        return ENODATA;
+
+    // One waveform per pass, back to back
+    int ch = cfg->ch;
+    int err = event_alloc_wave(ev, ch, r->samples);
+    if (err)
+        return err;
+    memcpy(ev->wave[ch], r->wave, r->samples * sizeof(float));
+    ev->board = cfg->board;
+    ev->ch_mask = 1 << ch;
+    ev->seq = r->pass;
+    ev->res.samples[ch] = r->samples;
+    ev->res.skew = GROUP_SKEW_NOT_MEASURED;
+    *t = r->pass * r->samples * cfg->sample_period;
+    r->pass++;
+    return 0;
+}
+
+static int next_capture(replay *r, struct event *ev, double *t) {
+    for (;;) {
+        if (r->pass == r->cfg->repeat)
+            return ENODATA;
+        int err = capture_read(r->f, ev);
+        if (err == 0)
+            break;
+        if (err != ENODATA)
+            return err;
+        if (r->read == 0)
+            return ENODATA; // Empty capture
+
+        // Rewind for the next pass, which starts one average interval after the last record
+        double duration = r->last_time - r->first_time;
+        double gap = r->read > 1 ? duration / (r->read - 1) : 0;
+        r->offset += duration + gap;
+        r->read = 0;
+        r->pass++;
+        if (fseek(r->f, r->data_start, SEEK_SET))
+            return errno;
+    }
+
+    if (r->pass == 0 && r->read == 0)
+        r->first_time = ev->started;
+    r->last_time = ev->started;
+    r->read++;
+    if (r->pass == 0 && ev->seq > r->max_seq)
+        r->max_seq = ev->seq;
+
+    *t = r->offset + ev->started - r->first_time;
+    ev->seq += r->pass * (r->max_seq + 1);
+    return 0;
+}
+
+int replay_next(replay *r, struct event *ev, double *t) {
+    if (r->cfg->format == REPLAY_CSV)
+        return next_csv(r, ev, t);
+    return next_capture(r, ev, t);
+}
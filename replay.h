@@ -0,0 +1,22 @@
+#ifndef REPLAY_H_INCLUDED
+#define REPLAY_H_INCLUDED
+
+// Source of previously recorded events: a binary capture (see capture.h)
+// or a single waveform in wave.csv format.
+//
+// Functions return 0 on success or a system error code,
+// replay_next returns ENODATA when all repeats are done.
+
+#include "config.h"
+#include "event.h"
+
+typedef struct replay replay;
+
+int replay_open(replay **pr, const struct replay_config *cfg);
+void replay_close(replay *r);
+
+// Fill ev with the next recorded event.
+// t receives the time of the event at original rate since the start of replay.
+int replay_next(replay *r, struct event *ev, double *t);
+
+#endif
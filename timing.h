@@ -0,0 +1,7 @@
+#ifndef TIMING_H_INCLUDED
+#define TIMING_H_INCLUDED
+
+// Seconds of CLOCK_MONOTONIC, used for all timestamps and durations
+double now();
+
+#endif
@@ -0,0 +1,194 @@
+#include "vsdc_group.h"
+
+#include <stdio.h>
+#include <errno.h>
+
+#include "vsdc4.h"
+#include "timing.h"
+
+int group_init(struct vsdc_group *group, device *dev, uint32_t base,
+               uint8_t ch_mask, uint32_t start_src, uint32_t sync_mux,
+               const struct vsdc_channel_settings *settings, uint8_t vec) {
+    if (ch_mask == 0 || (ch_mask >> GROUP_MAX_CHANNELS) != 0)
+        return EINVAL;
+
+    group->dev = dev;
+    group->base = base;
+    group->ch_mask = ch_mask;
+    group->start_src = start_src;
+    group->vec = vec;
+    // The last channel is the leader
+    for (int ch = 0; ch < GROUP_MAX_CHANNELS; ch++)
+        if (ch_mask & (1 << ch))
+            group->leader = ch;
+    group->stop_src = settings[group->leader].stop_src;
+
+    float time_quant;
+    int err = cv_read(dev, base + TIME_QUANT, (uint32_t *)&time_quant);
+    if (err)
+        return err;
+    group->time_quant = time_quant;
+
+    for (int ch = 0; ch < GROUP_MAX_CHANNELS; ch++) {
+        if (!(ch_mask & (1 << ch)))
+            continue;
+        uint32_t ch_base = base + getChannelRegistersOffset(ch);
+
+        const struct vsdc_channel_settings *s = &settings[ch];
+
+        // Start source is shared, interrupts are enabled for the leader only
+        uint32_t sr = start_src | s->stop_src | s->input;
+        if (ch == group->leader)
+            sr |= ADC_IRQ_ENABLED;
+        err = cv_write(dev, ch_base + ADC_SR, sr);
+        if (err)
+            return err;
+        err = cv_write(dev, ch_base + ADC_TIMER, (uint32_t)(s->time / time_quant));
+        if (err)
+            return err;
+        if (s->avgn) {
+            err = cv_write(dev, ch_base + ADC_AVGN, s->avgn);
+            if (err)
+                return err;
+        }
+        err = cv_write(dev, ch_base + ADC_WRITE, 0);
+        if (err)
+            return err;
+        if (start_src == ADC_START_SRC_BP) {
+            err = cv_write(dev, ch_base + BP0_SYNC_MUX, sync_mux);
+            if (err)
+                return err;
+        }
+    }
+
+    uint32_t leader_base = base + getChannelRegistersOffset(group->leader);
+    return cv_write(dev, leader_base + ADC_IRQ_VEC, vec);
+}
+
+// Write the same value to ADC_CSR of every channel of the group
+static int write_csr(struct vsdc_group *group, uint32_t csr) {
+    uint32_t addrs[GROUP_MAX_CHANNELS];
+    uint32_t data[GROUP_MAX_CHANNELS];
+    int n = 0;
+    for (int ch = 0; ch < GROUP_MAX_CHANNELS; ch++) {
+        if (!(group->ch_mask & (1 << ch)))
+            continue;
+        addrs[n] = group->base + getChannelRegistersOffset(ch) + ADC_CSR;
+        data[n] = csr;
+        n++;
+    }
+    return cv_write_multi(group->dev, addrs, data, n);
+}
+
+int group_arm(struct vsdc_group *group) {
+    uint32_t addrs[2 * GROUP_MAX_CHANNELS];
+    uint32_t data[2 * GROUP_MAX_CHANNELS];
+    int n = 0;
+    for (int ch = 0; ch < GROUP_MAX_CHANNELS; ch++) {
+        if (!(group->ch_mask & (1 << ch)))
+            continue;
+        uint32_t ch_base = group->base + getChannelRegistersOffset(ch);
+        // Set waveform offset to the beginning of buffer
+        addrs[n] = ch_base + ADC_WRITE;
+        data[n++] = 0;
+        addrs[n] = ch_base + ADC_CSR;
+        data[n++] = ADC_CSR_RESULT_MASK;
+    }
+    return cv_write_multi(group->dev, addrs, data, n);
+}
+
+int group_start(struct vsdc_group *group) {
+    if (group->start_src != ADC_START_SRC_PROG)
+        return EINVAL;
+    return write_csr(group, ADC_CSR_PSTART);
+}
+
+int group_read(struct vsdc_group *group, struct vsdc_group_result *res) {
+    double start = now();
+
+    // ADC_CSR, ADC_INT and ADC_WRITE of every channel
+    uint32_t addrs[3 * GROUP_MAX_CHANNELS];
+    uint32_t data[3 * GROUP_MAX_CHANNELS];
+    int n = 0;
+    for (int ch = 0; ch < GROUP_MAX_CHANNELS; ch++) {
+        if (!(group->ch_mask & (1 << ch)))
+            continue;
+        uint32_t ch_base = group->base + getChannelRegistersOffset(ch);
+        addrs[n++] = ch_base + ADC_CSR;
+        addrs[n++] = ch_base + ADC_INT;
+        addrs[n++] = ch_base + ADC_WRITE;
+    }
+    int err = cv_read_multi(group->dev, addrs, data, n);
+    if (err)
+        return err;
+
+    res->ready_mask = 0;
+    uint32_t min_samples = UINT32_MAX, max_samples = 0;
+    uint32_t *p = data;
+    for (int ch = 0; ch < GROUP_MAX_CHANNELS; ch++) {
+        if (!(group->ch_mask & (1 << ch))) {
+            res->status[ch] = 0;
+            res->integral[ch] = 0;
+            res->samples[ch] = 0;
+            continue;
+        }
+        res->status[ch] = p[0];
+        res->integral[ch] = *(float *)&p[1];
+        res->samples[ch] = p[2];
+        p += 3;
+
+        if (res->status[ch] & ADC_CSR_INTEGRAL_RDY)
+            res->ready_mask |= 1 << ch;
+        if (res->samples[ch] < min_samples)
+            min_samples = res->samples[ch];
+        if (res->samples[ch] > max_samples)
+            max_samples = res->samples[ch];
+    }
+    if (group->stop_src == ADC_STOP_SRC_TIMER)
+        res->skew = GROUP_SKEW_NOT_MEASURED;
+    else
+        res->skew = max_samples - min_samples;
+    res->handle_time = now() - start;
+    return 0;
+}
+
+int group_sample_period(struct vsdc_group *group, int ch, double *period) {
+    uint32_t avgn;
+    int err = cv_read(group->dev, group->base + getChannelRegistersOffset(ch) + ADC_AVGN, &avgn);
+    if (err)
+        return err;
+    *period = group->time_quant * (avgn ? avgn : 1);
+    return 0;
+}
+
+int group_read_waveform(struct vsdc_group *group, int ch, uint32_t samples, float *buf) {
+    uint32_t wf_base = group->base + getChannelWaveformOffset(ch);
+    return cv_read_block(group->dev, wf_base, buf, samples * sizeof(float));
+}
+
+void group_stats_add(struct vsdc_group_stats *stats, uint8_t ch_mask,
+                     const struct vsdc_group_result *res) {
+    stats->count++;
+    if (res->ready_mask != ch_mask)
+        stats->not_ready++;
+    if (res->skew != GROUP_SKEW_NOT_MEASURED) {
+        stats->skew_count++;
+        if (res->skew > stats->max_skew)
+            stats->max_skew = res->skew;
+    }
+    stats->total_handle_time += res->handle_time;
+    if (res->handle_time > stats->max_handle_time)
+        stats->max_handle_time = res->handle_time;
+}
+
+void group_stats_print(const struct vsdc_group_stats *stats) {
+    printf("groups: %lu (%lu not ready)\n", stats->count, stats->not_ready);
+    if (stats->skew_count)
+        printf("max skew: %u samples\n", stats->max_skew);
+    else
+        printf("max skew: not measured\n");
+    if (stats->count)
+        printf("handle time: avg %.1f us, max %.1f us\n",
+               stats->total_handle_time / stats->count * 1e6,
+               stats->max_handle_time * 1e6);
+}
@@ -0,0 +1,94 @@
+#ifndef VSDC_GROUP_H_INCLUDED
+#define VSDC_GROUP_H_INCLUDED
+
+// Coherent multi-channel measurements.
+//
+// All channels of a group are armed with the same external start source,
+// so they start on the same edge instead of one program start per channel.
+// Only one channel of the group (the leader) has its interrupt enabled:
+// one IRQ is raised per group and the whole group is read out with a single
+// batched transaction (see cv_read_multi).
+//
+// Functions return an error code just like functions from device_access.h.
+
+#include <stdint.h>
+
+#include "device_access.h"
+
+#define GROUP_MAX_CHANNELS 4
+// Value of vsdc_group_result.skew if the group has no spread to measure
+#define GROUP_SKEW_NOT_MEASURED 0xFFFFFFFFu
+
+// Settings of a single channel of a group
+struct vsdc_channel_settings {
+    uint32_t stop_src;  // One of ADC_STOP_SRC_*
+    uint32_t input;     // One of ADC_INPUT_*
+    float time;         // Channel timer in seconds
+    uint32_t avgn;      // Written to ADC_AVGN, 0 leaves it unchanged
+};
+
+struct vsdc_group {
+    device *dev;
+    uint32_t base;
+    uint8_t ch_mask;    // Bit N is set if channel N belongs to the group
+    uint32_t start_src; // One of ADC_START_SRC_*
+    uint32_t stop_src;  // Stop source of the leader, one of ADC_STOP_SRC_*
+    int leader;         // The only channel of the group which raises IRQ
+    uint8_t vec;        // Interrupt vector of the leader
+    float time_quant;   // Seconds per ADC sample, read from TIME_QUANT
+};
+
+struct vsdc_group_result {
+    uint8_t ready_mask; // Channels with ADC_CSR_INTEGRAL_RDY set
+    uint32_t status[GROUP_MAX_CHANNELS];
+    float integral[GROUP_MAX_CHANNELS];
+    uint32_t samples[GROUP_MAX_CHANNELS];
+    // Spread of ADC_WRITE between channels of the group, in samples.
+    // With timer stop all channels record the same number of samples,
+    // so the skew is GROUP_SKEW_NOT_MEASURED.
+    uint32_t skew;
+    double handle_time; // Seconds spent in group_read
+};
+
+// Accumulated statistics of handled groups
+struct vsdc_group_stats {
+    unsigned long count;
+    unsigned long not_ready; // Groups with at least one channel without integral
+    unsigned long skew_count; // Groups with measured skew
+    uint32_t max_skew;
+    double total_handle_time;
+    double max_handle_time;
+};
+
+// Configure channels from ch_mask for a coherent measurement.
+// start_src is one of ADC_START_SRC_*, sync_mux is written to BP0_SYNC_MUX
+// of every channel if start_src is ADC_START_SRC_BP.
+// settings is indexed by channel number.
+int group_init(struct vsdc_group *group, device *dev, uint32_t base,
+               uint8_t ch_mask, uint32_t start_src, uint32_t sync_mux,
+               const struct vsdc_channel_settings *settings, uint8_t vec);
+
+// Reset waveform offsets and clear result bits of all channels
+// so they wait for the next start.
+int group_arm(struct vsdc_group *group);
+
+// Start all channels of the group with a single bus transaction.
+// Only for groups with ADC_START_SRC_PROG start source.
+int group_start(struct vsdc_group *group);
+
+// Read status, integral and number of samples of every channel of the group.
+// Must be called after the leader's interrupt vector has been acknowledged.
+int group_read(struct vsdc_group *group, struct vsdc_group_result *res);
+
+// Seconds between recorded waveform samples of the channel:
+// ADC_AVGN samples are averaged into one.
+int group_sample_period(struct vsdc_group *group, int ch, double *period);
+
+// Read samples of the channel waveform into buf with block transfer
+int group_read_waveform(struct vsdc_group *group, int ch, uint32_t samples, float *buf);
+
+void group_stats_add(struct vsdc_group_stats *stats, uint8_t ch_mask,
+                     const struct vsdc_group_result *res);
+void group_stats_print(const struct vsdc_group_stats *stats);
+
+#endif